@@ -0,0 +1,228 @@
+#include "BackgroundModels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "opencv2/imgproc.hpp"
+
+namespace {
+    //rows per parallel strip, large enough that scheduling is negligible next to the per-pixel work
+    const int STRIP_ROWS = 32;
+
+    template <typename Body>
+    void for_each_row(int rows, const Body & body) {
+        int strips = (rows + STRIP_ROWS - 1) / STRIP_ROWS;
+        cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range & range) {
+            for (int y = range.start * STRIP_ROWS; y < std::min(range.end * STRIP_ROWS, rows); y++) {
+                body(y);
+            }
+        });
+    }
+
+    //the row kernels are branch-free over the pixels, so the compiler vectorises them
+
+    template <int channels>
+    void running_average_row(const unsigned char * in, float * background, unsigned char * out, int cols, float alpha, float threshold) {
+        for (int x = 0; x < cols; x++) {
+            int foreground = 0;
+            for (int c = 0; c < channels; c++) {
+                int i = channels * x + c;
+                float difference = in[i] - background[i];
+                foreground |= (std::fabs(difference) > threshold);
+                background[i] += alpha * difference;
+            }
+            out[x] = (unsigned char)(255 * foreground);
+        }
+    }
+
+    template <int channels>
+    void approximate_median_row(const unsigned char * in, unsigned char * background, unsigned char * out, int cols, int step, int threshold) {
+        for (int x = 0; x < cols; x++) {
+            int foreground = 0;
+            for (int c = 0; c < channels; c++) {
+                int i = channels * x + c;
+                int difference = in[i] - background[i];
+                foreground |= (std::abs(difference) > threshold);
+                background[i] += step * ((difference > 0) - (difference < 0));
+            }
+            out[x] = (unsigned char)(255 * foreground);
+        }
+    }
+
+    template <int channels>
+    void frame_difference_row(const unsigned char * in, const unsigned char * reference, unsigned char * out, int cols, int threshold) {
+        for (int x = 0; x < cols; x++) {
+            int foreground = 0;
+            for (int c = 0; c < channels; c++) {
+                int i = channels * x + c;
+                foreground |= (std::abs(in[i] - reference[i]) > threshold);
+            }
+            out[x] = (unsigned char)(255 * foreground);
+        }
+    }
+
+    //checks the input, sizes the mask and reports whether the model has to be (re)initialised from this frame
+    bool prepare(const cv::Mat & frame, const cv::Mat & model, int modelDepth, cv::OutputArray fgmask, cv::Mat & mask) {
+        CV_Assert((frame.depth() == CV_8U) && ((frame.channels() == 1) || (frame.channels() == 3)));
+        fgmask.create(frame.size(), CV_8UC1);
+        mask = fgmask.getMat();
+
+        bool initialise = (model.size() != frame.size()) || (model.type() != CV_MAKETYPE(modelDepth, frame.channels()));
+        if (initialise) {
+            mask.setTo(cv::Scalar::all(0));
+        }
+        return initialise;
+    }
+}
+
+BackgroundModelParams::BackgroundModelParams() : threshold(25), learningRate(0.02f), medianInterval(1), referenceFrames(25) {}
+
+std::string background_model_name(BackgroundModel model) {
+    switch (model) {
+    case BackgroundModel::RUNNING_AVERAGE:
+        return "average";
+    case BackgroundModel::APPROXIMATE_MEDIAN:
+        return "median";
+    case BackgroundModel::FRAME_DIFFERENCE:
+        return "difference";
+    default:
+        return "mog2";
+    }
+}
+
+bool parse_background_model(const std::string & name, BackgroundModel & model) {
+    for (BackgroundModel candidate : { BackgroundModel::MOG2, BackgroundModel::RUNNING_AVERAGE, BackgroundModel::APPROXIMATE_MEDIAN, BackgroundModel::FRAME_DIFFERENCE }) {
+        if (name == background_model_name(candidate)) {
+            model = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+cv::Ptr<cv::BackgroundSubtractor> create_background_model(BackgroundModel model, const BackgroundModelParams & parameters) {
+    switch (model) {
+    case BackgroundModel::RUNNING_AVERAGE:
+        return RunningAverageSubtractor::create(parameters);
+    case BackgroundModel::APPROXIMATE_MEDIAN:
+        return ApproximateMedianSubtractor::create(parameters);
+    case BackgroundModel::FRAME_DIFFERENCE:
+        return FrameDifferenceSubtractor::create(parameters);
+    default:
+        return cv::createBackgroundSubtractorMOG2();
+    }
+}
+
+cv::Ptr<RunningAverageSubtractor> RunningAverageSubtractor::create(const BackgroundModelParams & parameters) {
+    return cv::makePtr<RunningAverageSubtractor>(parameters);
+}
+
+RunningAverageSubtractor::RunningAverageSubtractor(const BackgroundModelParams & parameters) : params_(parameters) {}
+
+void RunningAverageSubtractor::apply(cv::InputArray image, cv::OutputArray fgmask, double learningRate) {
+    cv::Mat frame = image.getMat();
+    cv::Mat mask;
+    if (prepare(frame, background_, CV_32F, fgmask, mask)) {
+        frame.convertTo(background_, CV_MAKETYPE(CV_32F, frame.channels()));
+        return;
+    }
+
+    float alpha = (learningRate < 0) ? params_.learningRate : (float)learningRate;
+    float threshold = (float)params_.threshold;
+    bool color = (frame.channels() == 3);
+    for_each_row(frame.rows, [&](int y) {
+        const unsigned char * in = frame.ptr<unsigned char>(y);
+        float * background = background_.ptr<float>(y);
+        unsigned char * out = mask.ptr<unsigned char>(y);
+        if (color) {
+            running_average_row<3>(in, background, out, frame.cols, alpha, threshold);
+        }
+        else {
+            running_average_row<1>(in, background, out, frame.cols, alpha, threshold);
+        }
+    });
+}
+
+void RunningAverageSubtractor::getBackgroundImage(cv::OutputArray backgroundImage) const {
+    background_.convertTo(backgroundImage, CV_MAKETYPE(CV_8U, background_.channels()));
+}
+
+cv::Ptr<ApproximateMedianSubtractor> ApproximateMedianSubtractor::create(const BackgroundModelParams & parameters) {
+    return cv::makePtr<ApproximateMedianSubtractor>(parameters);
+}
+
+ApproximateMedianSubtractor::ApproximateMedianSubtractor(const BackgroundModelParams & parameters) : params_(parameters), frames_(0) {}
+
+void ApproximateMedianSubtractor::apply(cv::InputArray image, cv::OutputArray fgmask, double learningRate) {
+    cv::Mat frame = image.getMat();
+    cv::Mat mask;
+    if (prepare(frame, background_, CV_8U, fgmask, mask)) {
+        frame.copyTo(background_);
+        frames_ = 0;
+        return;
+    }
+
+    frames_++;
+    int step = ((learningRate != 0) && (frames_ % std::max(1, params_.medianInterval) == 0)) ? 1 : 0;
+    bool color = (frame.channels() == 3);
+    for_each_row(frame.rows, [&](int y) {
+        const unsigned char * in = frame.ptr<unsigned char>(y);
+        unsigned char * background = background_.ptr<unsigned char>(y);
+        unsigned char * out = mask.ptr<unsigned char>(y);
+        if (color) {
+            approximate_median_row<3>(in, background, out, frame.cols, step, params_.threshold);
+        }
+        else {
+            approximate_median_row<1>(in, background, out, frame.cols, step, params_.threshold);
+        }
+    });
+}
+
+void ApproximateMedianSubtractor::getBackgroundImage(cv::OutputArray backgroundImage) const {
+    background_.copyTo(backgroundImage);
+}
+
+cv::Ptr<FrameDifferenceSubtractor> FrameDifferenceSubtractor::create(const BackgroundModelParams & parameters) {
+    return cv::makePtr<FrameDifferenceSubtractor>(parameters);
+}
+
+FrameDifferenceSubtractor::FrameDifferenceSubtractor(const BackgroundModelParams & parameters) : params_(parameters), referenceCount_(0) {}
+
+void FrameDifferenceSubtractor::apply(cv::InputArray image, cv::OutputArray fgmask, double learningRate) {
+    cv::Mat frame = image.getMat();
+    cv::Mat mask;
+    if (prepare(frame, reference_, CV_8U, fgmask, mask)) {
+        frame.copyTo(reference_);
+        frame.convertTo(sum_, CV_MAKETYPE(CV_32F, frame.channels()));
+        referenceCount_ = 1;
+        return;
+    }
+
+    bool color = (frame.channels() == 3);
+    for_each_row(frame.rows, [&](int y) {
+        const unsigned char * in = frame.ptr<unsigned char>(y);
+        const unsigned char * reference = reference_.ptr<unsigned char>(y);
+        unsigned char * out = mask.ptr<unsigned char>(y);
+        if (color) {
+            frame_difference_row<3>(in, reference, out, frame.cols, params_.threshold);
+        }
+        else {
+            frame_difference_row<1>(in, reference, out, frame.cols, params_.threshold);
+        }
+    });
+
+    //only the first frames are averaged into the reference, after that the model costs one pass per frame
+    if ((referenceCount_ < params_.referenceFrames) && (learningRate != 0)) {
+        cv::accumulate(frame, sum_);
+        referenceCount_++;
+        sum_.convertTo(reference_, reference_.type(), 1.0 / referenceCount_);
+        if (referenceCount_ == params_.referenceFrames) {
+            sum_.release();
+        }
+    }
+}
+
+void FrameDifferenceSubtractor::getBackgroundImage(cv::OutputArray backgroundImage) const {
+    reference_.copyTo(backgroundImage);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+
+#include "opencv2/core.hpp"
+#include "opencv2/video.hpp"
+
+//background models selectable per session. MOG2 is OpenCV's and the most robust, the others assume a
+//static camera and stable lighting and trade mask quality for a much cheaper per-pixel update
+enum class BackgroundModel {
+	MOG2,
+	RUNNING_AVERAGE,
+	APPROXIMATE_MEDIAN,
+	FRAME_DIFFERENCE
+};
+
+struct BackgroundModelParams {
+	BackgroundModelParams();
+
+	//absolute difference from the background, in any channel, above which a pixel is foreground
+	int threshold;
+	//weight of the newest frame in the running average
+	float learningRate;
+	//frames between the approximate median's one-level steps towards the current frame. the median
+	//follows changes lasting longer than about 128 * medianInterval frames
+	int medianInterval;
+	//frames averaged into the frame difference model's static reference
+	int referenceFrames;
+};
+
+//name used on the command line and in the pipeline statistics
+std::string background_model_name(BackgroundModel model);
+bool parse_background_model(const std::string & name, BackgroundModel & model);
+
+cv::Ptr<cv::BackgroundSubtractor> create_background_model(BackgroundModel model, const BackgroundModelParams & parameters = BackgroundModelParams());
+
+//the subtractors below produce a 0/255 mask without shadows from 8-bit 1 or 3 channel frames. the first
+//frame only initialises the model. a learningRate of 0 in apply freezes the model, negative uses the params
+
+//exponentially weighted mean of past frames
+class RunningAverageSubtractor : public cv::BackgroundSubtractor {
+public:
+	static cv::Ptr<RunningAverageSubtractor> create(const BackgroundModelParams & parameters = BackgroundModelParams());
+
+	explicit RunningAverageSubtractor(const BackgroundModelParams & parameters);
+
+	void apply(cv::InputArray image, cv::OutputArray fgmask, double learningRate = -1) override;
+	void getBackgroundImage(cv::OutputArray backgroundImage) const override;
+private:
+	BackgroundModelParams params_;
+	cv::Mat background_;
+};
+
+//per-pixel approximate median: the background moves one level towards every frame, so it settles on
+//the value that the recent frames are above and below equally often
+class ApproximateMedianSubtractor : public cv::BackgroundSubtractor {
+public:
+	static cv::Ptr<ApproximateMedianSubtractor> create(const BackgroundModelParams & parameters = BackgroundModelParams());
+
+	explicit ApproximateMedianSubtractor(const BackgroundModelParams & parameters);
+
+	void apply(cv::InputArray image, cv::OutputArray fgmask, double learningRate = -1) override;
+	void getBackgroundImage(cv::OutputArray backgroundImage) const override;
+private:
+	BackgroundModelParams params_;
+	cv::Mat background_;
+	size_t frames_;
+};
+
+//difference against a fixed reference, the mean of the first referenceFrames frames
+class FrameDifferenceSubtractor : public cv::BackgroundSubtractor {
+public:
+	static cv::Ptr<FrameDifferenceSubtractor> create(const BackgroundModelParams & parameters = BackgroundModelParams());
+
+	explicit FrameDifferenceSubtractor(const BackgroundModelParams & parameters);
+
+	void apply(cv::InputArray image, cv::OutputArray fgmask, double learningRate = -1) override;
+	void getBackgroundImage(cv::OutputArray backgroundImage) const override;
+private:
+	BackgroundModelParams params_;
+	cv::Mat reference_, sum_;
+	int referenceCount_;
+};
@@ -0,0 +1,114 @@
+#include "Batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <set>
+
+#include "Calibration.h"
+#include "ThreadPool.h"
+#include "TrackFile.h"
+
+namespace {
+    const std::set<std::string> VIDEO_EXTENSIONS = { ".mp4", ".avi", ".mov", ".mkv", ".m4v", ".wmv" };
+
+    //first of directory/<stem><extension> and ./out/<stem><extension> that exists, or empty
+    std::string find_existing(const std::filesystem::path & directory, const std::string & stem, const std::string & extension) {
+        for (const std::filesystem::path & candidate : { directory / (stem + extension), std::filesystem::path("./out") / (stem + extension) }) {
+            if (std::filesystem::exists(candidate)) {
+                return candidate.string();
+            }
+        }
+        return "";
+    }
+}
+
+std::vector<BatchResult> run_batch(const std::string & directory, size_t concurrency, SessionOptions options) {
+    std::vector<std::filesystem::path> videos;
+    for (const auto & entry : std::filesystem::directory_iterator(directory)) {
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (entry.is_regular_file() && VIDEO_EXTENSIONS.contains(extension)) {
+            videos.push_back(entry.path());
+        }
+    }
+    std::sort(videos.begin(), videos.end());
+
+    std::filesystem::create_directories("./out");
+
+    //whole videos are the unit of parallelism, so each session tracks on the calling worker and
+    //preprocesses to the end instead of staying ahead of a playhead
+    options.headless = true;
+    options.lead = 0;
+    options.trackerThreads = 1;
+
+    std::vector<BatchResult> results(videos.size());
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t remaining = videos.size();
+
+    ThreadPool pool(std::max<size_t>(1, concurrency));
+    for (size_t i = 0; i < videos.size(); i++) {
+        pool.submit([&, i]() {
+            auto start = std::chrono::steady_clock::now();
+            BatchResult & result = results[i];
+            result.videoPath = videos[i].string();
+
+            try {
+                std::string stem = videos[i].stem().string();
+
+                SessionOptions videoOptions = options;
+                Calibration calibration;
+                std::string calibrationPath = find_existing(videos[i].parent_path(), stem, ".clb");
+                if (!calibrationPath.empty() && load_calibration(calibrationPath, calibration) && calibration.has_band()) {
+                    cv::VideoCapture video(result.videoPath);
+                    cv::Size frameSize(video.get(cv::CAP_PROP_FRAME_WIDTH), video.get(cv::CAP_PROP_FRAME_HEIGHT));
+                    videoOptions.roi = calibration.band(frameSize, Calibration::BAND_MARGIN);
+                    videoOptions.grayscale = true;
+                }
+
+                MillikanTracker millikanTracker(result.videoPath, "./out/" + stem, videoOptions);
+                millikanTracker.set_flag(MillikanTracker::AUTO_DETECT, true);
+
+                std::string dataPath = newest_track_file(find_existing(videos[i].parent_path(), stem, ".trk"), find_existing(videos[i].parent_path(), stem, ".txt"));
+                if (!dataPath.empty()) {
+                    millikanTracker.load_data(dataPath);
+                }
+                std::string keyframePath = find_existing(videos[i].parent_path(), stem, ".kfr");
+                if (!keyframePath.empty()) {
+                    millikanTracker.load_keyframes(keyframePath);
+                }
+                millikanTracker.open_journal();
+
+                while (millikanTracker.next_frame()) {}
+                millikanTracker.finish();
+
+                result.succeeded = true;
+            }
+            catch (const std::exception & e) {
+                result.succeeded = false;
+                result.error = e.what();
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            std::cout << (result.succeeded ? "Finished " : "Failed ") << result.videoPath << " in " << result.seconds << " s";
+            if (!result.succeeded) {
+                std::cout << ": " << result.error;
+            }
+            std::cout << std::endl;
+
+            if (--remaining == 0) {
+                finished.notify_all();
+            }
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&]() { return remaining == 0; });
+
+    return results;
+}
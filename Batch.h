@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "MillikanTracker.h"
+
+struct BatchResult {
+	std::string videoPath;
+	bool succeeded;
+	std::string error;
+	double seconds;
+};
+
+//preprocesses and auto-tracks every video in directory without a display, up to concurrency videos
+//at a time, writing ./out/<stem>.txt, .trk and .kfr like an interactive session. existing track and .kfr files
+//next to the videos (or already in ./out) are loaded first, and videos with a calibrated band in their
+//.clb are processed on that band in grayscale
+std::vector<BatchResult> run_batch(const std::string & directory, size_t concurrency, SessionOptions options = SessionOptions());
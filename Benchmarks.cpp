@@ -0,0 +1,519 @@
+#include "Benchmarks.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "opencv2/imgproc.hpp"
+#include "opencv2/tracking.hpp"
+#include "opencv2/video.hpp"
+
+#include "BackgroundModels.h"
+#include "Journal.h"
+#include "MaskKernels.h"
+#include "TrackFile.h"
+#include "TrackStore.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double milliseconds(Clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    //std::allocator that adds every allocation to a shared byte count
+    template <typename T>
+    struct CountingAllocator {
+        using value_type = T;
+
+        CountingAllocator(size_t & bytes) : bytes(&bytes) {}
+        template <typename U>
+        CountingAllocator(const CountingAllocator<U> & other) : bytes(other.bytes) {}
+
+        T * allocate(size_t n) {
+            *bytes += n * sizeof(T);
+            return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T * p, size_t n) {
+            *bytes -= n * sizeof(T);
+            std::allocator<T>().deallocate(p, n);
+        }
+
+        template <typename U>
+        bool operator==(const CountingAllocator<U> & other) const {
+            return bytes == other.bytes;
+        }
+
+        size_t * bytes;
+    };
+
+    //static noisy background with a few bright droplets drifting across it, so the subtractor has
+    //realistic sparse foreground to work on
+    std::vector<cv::Mat> synthetic_frames(cv::Size size, int count) {
+        uint32_t state = 12345;
+        auto next = [&state]() {
+            state = state * 1664525u + 1013904223u;
+            return state >> 24;
+        };
+
+        cv::Mat background(size, CV_8UC3);
+        for (int y = 0; y < size.height; y++) {
+            unsigned char * row = background.ptr<unsigned char>(y);
+            for (int x = 0; x < 3 * size.width; x++) {
+                row[x] = 40 + (y * 40) / size.height;
+            }
+        }
+
+        std::vector<cv::Mat> frames;
+        for (int i = 0; i < count; i++) {
+            cv::Mat frame = background.clone();
+            for (int y = 0; y < size.height; y++) {
+                unsigned char * row = frame.ptr<unsigned char>(y);
+                for (int x = 0; x < 3 * size.width; x++) {
+                    row[x] += next() & 0x7;
+                }
+            }
+            for (int d = 0; d < 30; d++) {
+                cv::Point center((d * 97 + 3 * i) % size.width, (d * 61 + 5 * i * (1 + d % 3)) % size.height);
+                cv::circle(frame, center, 3, cv::Scalar(220, 220, 220), cv::FILLED);
+            }
+            frames.push_back(frame);
+        }
+        return frames;
+    }
+}
+
+void run_benchmarks(std::ostream & out) {
+    benchmark_preprocessing(out);
+    benchmark_background_models(out);
+    benchmark_track_store(out);
+    benchmark_track_files(out);
+    benchmark_journal(out);
+    benchmark_pyramid_tracking(out);
+}
+
+void benchmark_preprocessing(std::ostream & out) {
+    const cv::Size size(1280, 1024);
+    const int warmup = 20;
+    std::vector<cv::Mat> frames = synthetic_frames(size, 120);
+
+    //a quarter of the frame height, about what lies between the rule markings in typical footage
+    const cv::Rect band(0, 3 * size.height / 8, size.width, size.height / 4);
+
+    Clock::duration legacyTotal(0), legacyPost(0), fusedTotal(0), fusedPost(0), bandTotal(0), bandPost(0);
+    {
+        cv::Ptr<cv::BackgroundSubtractor> backSub = cv::createBackgroundSubtractorMOG2();
+        cv::Mat processed;
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto start = Clock::now();
+            cv::Mat fgMask;
+            backSub->apply(frames[i], fgMask);
+            auto subtracted = Clock::now();
+            cv::medianBlur(fgMask, fgMask, 5);
+            processed.release();
+            cv::bitwise_and(frames[i], frames[i], processed, fgMask);
+            auto end = Clock::now();
+
+            if (i >= warmup) {
+                legacyTotal += end - start;
+                legacyPost += end - subtracted;
+            }
+        }
+    }
+    {
+        cv::Ptr<cv::BackgroundSubtractor> backSub = cv::createBackgroundSubtractorMOG2();
+        MaskKernels kernels;
+        cv::Mat rawMask, fgMask, processed;
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto start = Clock::now();
+            backSub->apply(frames[i], rawMask);
+            auto subtracted = Clock::now();
+            kernels.median5_masked_copy(rawMask, frames[i], fgMask, processed);
+            auto end = Clock::now();
+
+            if (i >= warmup) {
+                fusedTotal += end - start;
+                fusedPost += end - subtracted;
+            }
+        }
+    }
+    {
+        cv::Ptr<cv::BackgroundSubtractor> backSub = cv::createBackgroundSubtractorMOG2();
+        MaskKernels kernels;
+        cv::Mat gray, rawMask, fgMask, processed;
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto start = Clock::now();
+            cv::cvtColor(frames[i](band), gray, cv::COLOR_BGR2GRAY);
+            backSub->apply(gray, rawMask);
+            auto subtracted = Clock::now();
+            kernels.median5_masked_copy(rawMask, gray, fgMask, processed);
+            auto end = Clock::now();
+
+            if (i >= warmup) {
+                bandTotal += end - start;
+                bandPost += end - subtracted;
+            }
+        }
+    }
+
+    double measured = frames.size() - warmup;
+    out << "preprocessing, " << size.width << "x" << size.height << ", ms per frame over " << measured << " frames" << std::endl;
+    out << "\tlegacy (MOG2 + medianBlur + bitwise_and): " << milliseconds(legacyTotal) / measured
+        << " total, " << milliseconds(legacyPost) / measured << " after subtraction" << std::endl;
+    out << "\tfused (MOG2 + median5_masked_copy):       " << milliseconds(fusedTotal) / measured
+        << " total, " << milliseconds(fusedPost) / measured << " after subtraction" << std::endl;
+    out << "\tfused on a grayscale " << band.height << " row band:         " << milliseconds(bandTotal) / measured
+        << " total, " << milliseconds(bandPost) / measured << " after subtraction" << std::endl;
+}
+
+void benchmark_background_models(std::ostream & out) {
+    const cv::Size size(1280, 1024);
+    const int warmup = 20;
+    std::vector<cv::Mat> frames = synthetic_frames(size, 120);
+    const BackgroundModel models[] = { BackgroundModel::MOG2, BackgroundModel::RUNNING_AVERAGE, BackgroundModel::APPROXIMATE_MEDIAN, BackgroundModel::FRAME_DIFFERENCE };
+
+    //MOG2 masks as the reference for mask quality, shadows (127) count as background
+    std::vector<cv::Mat> reference(frames.size());
+    for (const BackgroundModel model : models) {
+        cv::Ptr<cv::BackgroundSubtractor> backSub = create_background_model(model);
+        Clock::duration total(0);
+        double mismatch = 0.0;
+        cv::Mat mask, binary, difference;
+        for (size_t i = 0; i < frames.size(); i++) {
+            auto start = Clock::now();
+            backSub->apply(frames[i], mask);
+            auto end = Clock::now();
+
+            cv::threshold(mask, binary, 127, 255, cv::THRESH_BINARY);
+            if (model == BackgroundModel::MOG2) {
+                reference[i] = binary.clone();
+            }
+            if (i >= warmup) {
+                total += end - start;
+                cv::compare(binary, reference[i], difference, cv::CMP_NE);
+                mismatch += (double)cv::countNonZero(difference) / difference.total();
+            }
+        }
+
+        double measured = frames.size() - warmup;
+        out << "background model " << background_model_name(model) << ": " << milliseconds(total) / measured << " ms per frame, "
+            << (100.0 * mismatch / measured) << "% of pixels differ from mog2" << std::endl;
+    }
+}
+
+void benchmark_track_store(std::ostream & out) {
+    const size_t frames = 100000;
+    const size_t droplets = 200;
+    const size_t trackLength = 5000;
+
+    using Map = std::unordered_map<size_t, cv::Rect, std::hash<size_t>, std::equal_to<size_t>, CountingAllocator<std::pair<const size_t, cv::Rect>>>;
+    size_t mapBytes = 0;
+    std::vector<Map> maps;
+    maps.reserve(droplets);
+    TrackStore store;
+
+    //droplets start at evenly spread frames and are tracked for trackLength frames each
+    auto start = Clock::now();
+    for (size_t i = 0; i < droplets; i++) {
+        maps.emplace_back(0, std::hash<size_t>(), std::equal_to<size_t>(), CountingAllocator<std::pair<const size_t, cv::Rect>>(mapBytes));
+        size_t first = i * (frames - trackLength) / droplets;
+        for (size_t frame = first; frame < first + trackLength; frame++) {
+            maps[i][frame] = cv::Rect((int)(frame % 1280), (int)(i * 5), 12, 12);
+        }
+    }
+    auto mapBuilt = Clock::now();
+    for (size_t i = 0; i < droplets; i++) {
+        store.add_track();
+        size_t first = i * (frames - trackLength) / droplets;
+        for (size_t frame = first; frame < first + trackLength; frame++) {
+            store.set(i, frame, cv::Rect((int)(frame % 1280), (int)(i * 5), 12, 12));
+        }
+    }
+    auto storeBuilt = Clock::now();
+
+    //what draw_overlay_ does for every frame shown
+    int64_t mapSum = 0, storeSum = 0;
+    auto lookupStart = Clock::now();
+    for (size_t frame = 0; frame < frames; frame++) {
+        for (size_t i = 0; i < droplets; i++) {
+            auto it = maps[i].find(frame);
+            if (it != maps[i].end()) {
+                mapSum += it->second.x;
+            }
+        }
+    }
+    auto mapLookedUp = Clock::now();
+    cv::Rect box;
+    for (size_t frame = 0; frame < frames; frame++) {
+        for (size_t i = 0; i < droplets; i++) {
+            if (store.get(i, frame, box)) {
+                storeSum += box.x;
+            }
+        }
+    }
+    auto storeLookedUp = Clock::now();
+
+    //what finish does, the maps are only walked in hash order while the store is in frame order
+    for (const Map & map : maps) {
+        for (const auto & [frame, rect] : map) {
+            mapSum += rect.y + frame;
+        }
+    }
+    auto mapScanned = Clock::now();
+    for (size_t i = 0; i < droplets; i++) {
+        store.for_each(i, [&](size_t frame, const cv::Rect & rect) {
+            storeSum += rect.y + frame;
+        });
+    }
+    auto storeScanned = Clock::now();
+
+    out << "track store, " << droplets << " droplets over " << frames << " frames, " << store.count() << " boxes"
+        << ((mapSum == storeSum) ? "" : " (results differ)") << std::endl;
+    out << "\tunordered_map: " << mapBytes << " bytes, " << milliseconds(mapBuilt - start) << " ms to fill, "
+        << milliseconds(mapLookedUp - lookupStart) << " ms for every per-frame lookup, " << milliseconds(mapScanned - storeLookedUp) << " ms to scan" << std::endl;
+    out << "\tTrackStore:    " << store.memory_bytes() << " bytes, " << milliseconds(storeBuilt - mapBuilt) << " ms to fill, "
+        << milliseconds(storeLookedUp - mapLookedUp) << " ms for every per-frame lookup, " << milliseconds(storeScanned - mapScanned) << " ms to scan" << std::endl;
+}
+
+void benchmark_track_files(std::ostream & out) {
+    const size_t droplets = 200;
+    const size_t trackLength = 5000;
+
+    TrackStore tracks;
+    for (size_t i = 0; i < droplets; i++) {
+        tracks.add_track();
+        for (size_t frame = 10 * i; frame < 10 * i + trackLength; frame++) {
+            tracks.set(i, frame, cv::Rect((int)(frame % 1280), (int)((7 * i + frame / 3) % 1024), 11 + (int)(i % 4), 12));
+        }
+    }
+
+    std::filesystem::create_directories("./temp");
+    const std::string legacyPath = "./temp/benchmark_legacy.txt";
+    const std::string textPath = "./temp/benchmark.txt";
+    const std::string binaryPath = "./temp/benchmark.trk";
+    const std::string convertedPath = "./temp/benchmark_converted.trk";
+
+    //the original finish and load_data bodies
+    auto start = Clock::now();
+    {
+        std::ofstream file(legacyPath);
+        file << "drop#\tframe\tx\ty\tS_x\tS_y" << std::endl;
+        for (size_t i = 0; i < droplets; i++) {
+            tracks.for_each(i, [&](size_t frame, const cv::Rect & bbox) {
+                double S_x = (double)(bbox.width) / 2.0;
+                double x = bbox.x + S_x;
+                double S_y = (double)(bbox.height) / 2.0;
+                double y = bbox.y + S_x;
+                file << i << '\t' << frame << '\t' << x << '\t' << y << '\t' << S_x << '\t' << S_y << std::endl;
+            });
+        }
+    }
+    auto legacySaved = Clock::now();
+    TrackStore legacyLoaded;
+    {
+        std::ifstream dataFile(legacyPath);
+        std::string line;
+        std::getline(dataFile, line);
+        while (getline(dataFile, line)) {
+            std::stringstream linestream(line);
+            std::string token;
+            getline(linestream, token, '\t');
+            size_t droplet = std::stoull(token);
+            getline(linestream, token, '\t');
+            size_t frame = std::stoull(token);
+            getline(linestream, token, '\t');
+            double x = std::stold(token);
+            getline(linestream, token, '\t');
+            double y = std::stold(token);
+            getline(linestream, token, '\t');
+            double S_x = std::stold(token);
+            getline(linestream, token, '\t');
+            double S_y = std::stold(token);
+
+            if (legacyLoaded.track_count() < droplet + 1) {
+                legacyLoaded.resize(droplet + 1);
+            }
+            legacyLoaded.set(droplet, frame, cv::Rect(x - S_x, y - S_x, 2 * S_x, 2 * S_y));
+        }
+    }
+    auto legacyLoadedAt = Clock::now();
+
+    save_tracks_tsv(textPath, tracks);
+    auto textSaved = Clock::now();
+    TrackStore textLoaded;
+    load_tracks_tsv(textPath, textLoaded);
+    auto textLoadedAt = Clock::now();
+
+    save_tracks_binary(binaryPath, tracks);
+    auto binarySaved = Clock::now();
+    TrackStore binaryLoaded;
+    load_tracks_binary(binaryPath, binaryLoaded);
+    auto binaryLoadedAt = Clock::now();
+
+    //the boxes are not square, so a y centre taken from the width shows up in the written rows even
+    //though reading it back the same way would hide it
+    bool centred;
+    {
+        std::ifstream text(textPath);
+        std::string line;
+        std::getline(text, line);
+        std::getline(text, line);
+        std::stringstream row(line);
+        size_t droplet, frame;
+        double x, y;
+        row >> droplet >> frame >> x >> y;
+        cv::Rect box;
+        centred = tracks.get(droplet, frame, box) && (y == box.y + box.height / 2.0);
+    }
+    convert_tracks(textPath, convertedPath);
+    TrackStore converted;
+    load_tracks(convertedPath, converted);
+
+    //all of them must give back the boxes they were given
+    auto same = [&](const TrackStore & loaded) {
+        if ((loaded.track_count() != tracks.track_count()) || (loaded.count() != tracks.count())) {
+            return false;
+        }
+        bool equal = true;
+        cv::Rect box;
+        for (size_t i = 0; i < tracks.track_count(); i++) {
+            tracks.for_each(i, [&](size_t frame, const cv::Rect & bbox) {
+                equal = equal && loaded.get(i, frame, box) && (box == bbox);
+            });
+        }
+        return equal;
+    };
+
+    out << "track files, " << tracks.count() << " boxes" << std::endl;
+    out << "\tlegacy tsv: " << milliseconds(legacySaved - start) << " ms save, " << milliseconds(legacyLoadedAt - legacySaved) << " ms load, "
+        << std::filesystem::file_size(legacyPath) << " bytes" << (same(legacyLoaded) ? "" : " (round trip differs)") << std::endl;
+    out << "\ttsv:        " << milliseconds(textSaved - legacyLoadedAt) << " ms save, " << milliseconds(textLoadedAt - textSaved) << " ms load, "
+        << std::filesystem::file_size(textPath) << " bytes" << (same(textLoaded) ? "" : " (round trip differs)")
+        << (centred ? "" : " (y is not the box centre)") << (same(converted) ? "" : " (converted to .trk differs)") << std::endl;
+    out << "\tbinary:     " << milliseconds(binarySaved - textLoadedAt) << " ms save, " << milliseconds(binaryLoadedAt - binarySaved) << " ms load, "
+        << std::filesystem::file_size(binaryPath) << " bytes" << (same(binaryLoaded) ? "" : " (round trip differs)") << std::endl;
+
+    for (const std::string & path : { legacyPath, textPath, binaryPath, convertedPath }) {
+        std::filesystem::remove(path);
+    }
+}
+
+void benchmark_journal(std::ostream & out) {
+    //the same number of records as MillikanTracker's JOURNAL_COMPACT_RECORDS
+    const size_t records = (size_t)1 << 20;
+    const size_t droplets = 200;
+
+    std::filesystem::create_directories("./temp");
+    const std::string path = "./temp/benchmark.jnl";
+
+    Journal journal;
+    journal.open(path);
+    auto start = Clock::now();
+    for (size_t i = 0; i < records; i++) {
+        journal.set_box(i % droplets, i / droplets, cv::Rect((int)(i % 1280), (int)(i % 1024), 12, 12));
+    }
+    auto appended = Clock::now();
+    journal.close();
+    auto closed = Clock::now();
+
+    TrackStore tracks;
+    std::unordered_set<int> keyframes;
+    size_t replayed = Journal::replay(path, tracks, keyframes);
+    auto replayedAt = Clock::now();
+
+    out << "journal, " << records << " box edits" << std::endl;
+    out << "\t" << 1e6 * milliseconds(appended - start) / records << " ns per edit on the editing thread, "
+        << milliseconds(closed - appended) << " ms to flush the rest on close" << std::endl;
+    out << "\t" << milliseconds(replayedAt - closed) << " ms to replay " << replayed << " records, "
+        << std::filesystem::file_size(path) << " bytes" << std::endl;
+
+    std::filesystem::remove(path);
+}
+
+void benchmark_pyramid_tracking(std::ostream & out) {
+    const int frames = 100;
+    const int trackingWidth = 1280;
+
+    out << "pyramid tracking, one droplet over " << frames << " frames:" << std::endl;
+    for (cv::Size size : { cv::Size(1280, 1024), cv::Size(2560, 2048) }) {
+        //a masked frame is black apart from the droplets, one drifting droplet whose size scales with the camera
+        int radius = 3 * size.width / 1280;
+        auto center_at = [&](int i) {
+            return cv::Point2f(size.width / 3.0f + 1.5f * i * size.width / 1280, size.height / 2.0f - 0.7f * i * size.width / 1280);
+        };
+        std::vector<cv::Mat> masks, processed;
+        for (int i = 0; i < frames; i++) {
+            cv::Mat mask = cv::Mat::zeros(size, CV_8UC1);
+            cv::circle(mask, cv::Point(center_at(i)), radius, cv::Scalar(255), cv::FILLED);
+            masks.push_back(mask);
+            cv::Mat frame;
+            cv::cvtColor(mask, frame, cv::COLOR_GRAY2BGR);
+            processed.push_back(frame);
+        }
+
+        int levels = 0;
+        while ((size.width >> levels) > trackingWidth) {
+            levels++;
+        }
+        int scale = 1 << levels;
+        int side = 6 * radius;
+        cv::Point2f start = center_at(0);
+        cv::Rect box(cvRound(start.x) - side / 2, cvRound(start.y) - side / 2, side, side);
+
+        Clock::duration fullTime(0), pyramidTime(0);
+        double fullError = 0.0, pyramidError = 0.0;
+        {
+            cv::Ptr<cv::Tracker> tracker = cv::TrackerCSRT::create();
+            tracker->init(processed[0], box);
+            for (int i = 1; i < frames; i++) {
+                cv::Rect found;
+                auto begin = Clock::now();
+                tracker->update(processed[i], found);
+                fullTime += Clock::now() - begin;
+                cv::Point2f error = cv::Point2f(found.x + found.width / 2.0f, found.y + found.height / 2.0f) - center_at(i);
+                fullError += std::sqrt(error.x * error.x + error.y * error.y);
+            }
+        }
+        {
+            //the same steps as MillikanTracker's tracking_frame_ and from_tracking_
+            std::vector<cv::Mat> pyramid(levels);
+            auto build = [&](const cv::Mat & frame) -> const cv::Mat & {
+                const cv::Mat * level = &frame;
+                for (cv::Mat & next : pyramid) {
+                    cv::pyrDown(*level, next);
+                    level = &next;
+                }
+                return *level;
+            };
+
+            cv::Ptr<cv::Tracker> tracker = cv::TrackerCSRT::create();
+            tracker->init(build(processed[0]), cv::Rect(box.x / scale, box.y / scale, box.width / scale, box.height / scale));
+            for (int i = 1; i < frames; i++) {
+                cv::Rect found;
+                auto begin = Clock::now();
+                tracker->update(build(processed[i]), found);
+                cv::Rect window = cv::Rect(found.x * scale - scale, found.y * scale - scale, (found.width + 2) * scale, (found.height + 2) * scale)
+                    & cv::Rect(0, 0, size.width, size.height);
+                cv::Moments moments = cv::moments(masks[i](window), true);
+                cv::Point2f center = (moments.m00 > 0.0)
+                    ? cv::Point2f(window.x + moments.m10 / moments.m00, window.y + moments.m01 / moments.m00)
+                    : cv::Point2f(window.x + window.width / 2.0f, window.y + window.height / 2.0f);
+                pyramidTime += Clock::now() - begin;
+                cv::Point2f error = center - center_at(i);
+                pyramidError += std::sqrt(error.x * error.x + error.y * error.y);
+            }
+        }
+
+        out << "\t" << size.width << "x" << size.height << " full resolution: " << milliseconds(fullTime) / (frames - 1) << " ms/update, "
+            << fullError / (frames - 1) << " px mean centre error" << std::endl;
+        out << "\t" << size.width << "x" << size.height << " " << levels << " pyramid levels: " << milliseconds(pyramidTime) / (frames - 1) << " ms/update, "
+            << pyramidError / (frames - 1) << " px mean centre error" << std::endl;
+    }
+}
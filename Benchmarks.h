@@ -0,0 +1,29 @@
+#pragma once
+
+#include <ostream>
+
+//timing comparisons between the original and optimised code paths, run with --benchmark
+void run_benchmarks(std::ostream & out);
+
+//per-frame cost of MOG2 + medianBlur + masked bitwise_and against MOG2 + the fused MaskKernels pass,
+//on the full colour frame and on a grayscale band as used with a calibrated roi
+void benchmark_preprocessing(std::ostream & out);
+
+//per-frame cost of each BackgroundModel and the fraction of pixels its mask disagrees with MOG2's
+void benchmark_background_models(std::ostream & out);
+
+//memory, per-frame lookup and full scan of a 100k frame session's boxes in per-droplet unordered_maps
+//against the TrackStore
+void benchmark_track_store(std::ostream & out);
+
+//save and load times of the same tracks through the original getline/stold and endl code, the
+//from_chars/to_chars TSV path and the binary .trk format. checks that non-square boxes come back the
+//same from each and from a .txt converted to .trk, and that the TSV rows hold the box centres
+void benchmark_track_files(std::ostream & out);
+
+//cost of journaling an edit on the editing thread and of replaying a journal of the length that triggers compaction
+void benchmark_journal(std::ostream & out);
+
+//per-update cost and centre error of CSRT on full resolution masked frames against CSRT on a pyramid
+//level no wider than 1280 with the box refined on the full resolution mask, at two camera resolutions
+void benchmark_pyramid_tracking(std::ostream & out);
@@ -0,0 +1,165 @@
+#include "Calibration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "opencv2/imgproc.hpp"
+#include "opencv2/videoio.hpp"
+
+namespace {
+    //a marking is compared with the rows this far above and below it, so markings up to twice this thick
+    //are found, while brightness steps at the edge of the illuminated field are not
+    const int RIDGE_REACH = 6;
+    //closest the two markings can be
+    const int MIN_SEPARATION = 20;
+    //a marking must stand out this many times the median ridge strength of the profile, and by at least
+    //MIN_RIDGE grey levels
+    const float MIN_CONTRAST = 6.0f;
+    const float MIN_RIDGE = 2.0f;
+
+    //parabola through the peak and its neighbours, the vertex offset is within half a row of the peak
+    double refine_peak(const cv::Mat & ridge, int row) {
+        if ((row == 0) || (row + 1 == ridge.rows)) {
+            return row;
+        }
+        float above = ridge.at<float>(row - 1), peak = ridge.at<float>(row), below = ridge.at<float>(row + 1);
+        float curvature = above - 2.0f * peak + below;
+        if (curvature >= 0.0f) {
+            return row;
+        }
+        return row + std::clamp(0.5 * (above - below) / curvature, -0.5, 0.5);
+    }
+}
+
+Calibration::Calibration() :
+    pixels(0.0),
+    tenthsOfMm(0.0),
+    lowY(-1),
+    highY(-1)
+{}
+
+bool Calibration::has_band() const {
+    return (lowY >= 0) && (highY >= 0);
+}
+
+cv::Rect Calibration::band(cv::Size frameSize, int margin) const {
+    if (!has_band()) {
+        return cv::Rect();
+    }
+
+    int top = std::min(lowY, highY) - margin;
+    int bottom = std::max(lowY, highY) + margin + 1;
+    return cv::Rect(0, top, frameSize.width, bottom - top) & cv::Rect(cv::Point(0, 0), frameSize);
+}
+
+bool load_calibration(const std::string & path, Calibration & calibration) {
+    std::ifstream calibrationFile(path);
+    std::string line;
+    if (!std::getline(calibrationFile, line) || !std::getline(calibrationFile, line)) {
+        return false;
+    }
+
+    std::stringstream linestream(line);
+    Calibration loaded;
+    if (!(linestream >> loaded.pixels >> loaded.tenthsOfMm)) {
+        return false;
+    }
+    if (!(linestream >> loaded.lowY >> loaded.highY)) {
+        loaded.lowY = loaded.highY = -1;
+    }
+
+    calibration = loaded;
+    return true;
+}
+
+void save_calibration(const std::string & path, const Calibration & calibration) {
+    std::ofstream calibrationFile(path);
+    calibrationFile << "pix\ttenths of mm\tlow y\thigh y\n" << calibration.pixels << '\t' << calibration.tenthsOfMm << '\t' << calibration.lowY << '\t' << calibration.highY << std::endl;
+    calibrationFile.close();
+}
+
+Calibration calibration_from_markings(double lowY, double highY, double tenthsOfMm) {
+    Calibration calibration;
+    calibration.pixels = std::fabs(highY - lowY);
+    calibration.tenthsOfMm = std::fabs(tenthsOfMm);
+    calibration.lowY = static_cast<int>(std::lround(lowY));
+    calibration.highY = static_cast<int>(std::lround(highY));
+    return calibration;
+}
+
+bool detect_rule_lines(const std::string & videoPath, double & lowY, double & highY, size_t frames) {
+    cv::VideoCapture video(videoPath);
+    if (!video.isOpened()) {
+        throw std::runtime_error("Failed to open video: " + videoPath);
+    }
+
+    //mean of every row, summed over the frames. droplets move between frames and average out, the
+    //markings stay put
+    cv::Mat frame, gray, rowMeans, profile;
+    size_t read = 0;
+    for (; (read < frames) && video.read(frame); read++) {
+        if (frame.channels() == 3) {
+            cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        }
+        else {
+            gray = frame;
+        }
+        cv::reduce(gray, rowMeans, 1, cv::REDUCE_AVG, CV_32F);
+        if (profile.empty()) {
+            profile = cv::Mat::zeros(rowMeans.size(), CV_32F);
+        }
+        profile += rowMeans;
+    }
+    if ((read == 0) || (profile.rows <= 2 * RIDGE_REACH + 2)) {
+        return false;
+    }
+    profile /= static_cast<double>(read);
+
+    //ridge strength of row i + RIDGE_REACH: how far it is below, or above, both rows RIDGE_REACH away.
+    //whole-column operations, so they run vectorised
+    int n = profile.rows - 2 * RIDGE_REACH;
+    cv::Mat centre = profile.rowRange(RIDGE_REACH, RIDGE_REACH + n);
+    cv::Mat above, below, darker, brighter, ridge;
+    cv::subtract(profile.rowRange(0, n), centre, above);
+    cv::subtract(profile.rowRange(2 * RIDGE_REACH, 2 * RIDGE_REACH + n), centre, below);
+    cv::min(above, below, darker);
+    cv::max(above, below, brighter);
+    cv::max(darker, -brighter, ridge);
+
+    std::vector<float> strengths(n);
+    for (int i = 0; i < n; i++) {
+        strengths[i] = std::fabs(ridge.at<float>(i));
+    }
+    std::nth_element(strengths.begin(), strengths.begin() + strengths.size() / 2, strengths.end());
+    float threshold = std::max(MIN_CONTRAST * strengths[strengths.size() / 2], MIN_RIDGE);
+
+    //strongest local maximum, then the strongest one far enough from it
+    int peaks[2] = { -1, -1 };
+    for (int pass = 0; pass < 2; pass++) {
+        float best = threshold;
+        for (int i = 1; i + 1 < n; i++) {
+            float value = ridge.at<float>(i);
+            if ((value < best) || (value < ridge.at<float>(i - 1)) || (value < ridge.at<float>(i + 1))) {
+                continue;
+            }
+            if ((pass == 1) && (std::abs(i - peaks[0]) < MIN_SEPARATION)) {
+                continue;
+            }
+            best = value;
+            peaks[pass] = i;
+        }
+        if (peaks[pass] < 0) {
+            return false;
+        }
+    }
+
+    double first = refine_peak(ridge, peaks[0]) + RIDGE_REACH;
+    double second = refine_peak(ridge, peaks[1]) + RIDGE_REACH;
+    lowY = std::max(first, second);
+    highY = std::min(first, second);
+    return true;
+}
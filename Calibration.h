@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+#include "opencv2/core.hpp"
+
+//contents of a .clb file: the pixel distance between the two rule markings, their real distance and,
+//since the band was added to the format, the rows of the markings themselves
+struct Calibration {
+	Calibration();
+
+	//sub-pixel when the markings were detected automatically
+	double pixels;
+	double tenthsOfMm;
+	//rows of the lower and upper rule marking, -1 in files written before they were stored
+	int lowY;
+	int highY;
+
+	bool has_band() const;
+	//full-width rows between the markings, widened by margin on each side and clipped to frameSize.
+	//empty if the file has no band
+	cv::Rect band(cv::Size frameSize, int margin) const;
+
+	//rows usually kept above and below the markings so droplets crossing them are still tracked
+	static const int BAND_MARGIN = 16;
+};
+
+//false if the file cannot be opened or parsed. files with only the pixel and distance columns load without a band
+bool load_calibration(const std::string & path, Calibration & calibration);
+void save_calibration(const std::string & path, const Calibration & calibration);
+//calibration for markings at the given, possibly sub-pixel, rows
+Calibration calibration_from_markings(double lowY, double highY, double tenthsOfMm);
+
+//finds the two rule markings as the strongest thin horizontal ridges, dark or bright, in the row
+//intensity profile averaged over the first frames of the video. lowY is the lower marking on screen.
+//false if fewer than two rows stand out clearly from the rest of the profile
+bool detect_rule_lines(const std::string & videoPath, double & lowY, double & highY, size_t frames = 25);
@@ -0,0 +1,88 @@
+#include "CentroidTracker.h"
+
+#include <cstdint>
+
+namespace {
+    struct WindowMoments {
+        int64_t m00 = 0;
+        int64_t m10 = 0;
+        int64_t m01 = 0;
+    };
+
+    //zeroth and first order moments of the nonzero pixels. the inner loops are branch-free so the
+    //compiler vectorises them, and only the search window is touched
+    template <int channels>
+    WindowMoments window_moments(const cv::Mat & window) {
+        WindowMoments moments;
+        for (int y = 0; y < window.rows; y++) {
+            const unsigned char * row = window.ptr<unsigned char>(y);
+            int32_t count = 0;
+            int32_t xSum = 0;
+            for (int x = 0; x < window.cols; x++) {
+                unsigned char value = row[channels * x];
+                for (int c = 1; c < channels; c++) {
+                    value |= row[channels * x + c];
+                }
+                int32_t foreground = (value != 0);
+                count += foreground;
+                xSum += foreground * x;
+            }
+            moments.m00 += count;
+            moments.m10 += xSum;
+            moments.m01 += (int64_t)count * y;
+        }
+        return moments;
+    }
+}
+
+CentroidTracker::Params::Params() : searchScale(2.0f), minArea(4), velocitySmoothing(0.5f) {}
+
+cv::Ptr<CentroidTracker> CentroidTracker::create(const Params & parameters) {
+    return cv::makePtr<CentroidTracker>(parameters);
+}
+
+CentroidTracker::CentroidTracker(const Params & parameters) : params_(parameters) {}
+
+void CentroidTracker::init(cv::InputArray image, const cv::Rect & boundingBox) {
+    center_ = cv::Point2d(boundingBox.x + boundingBox.width / 2.0, boundingBox.y + boundingBox.height / 2.0);
+    velocity_ = cv::Point2d(0, 0);
+    size_ = boundingBox.size();
+}
+
+bool CentroidTracker::update(cv::InputArray image, cv::Rect & boundingBox) {
+    cv::Mat frame = image.getMat();
+    CV_Assert((frame.depth() == CV_8U) && ((frame.channels() == 1) || (frame.channels() == 3)));
+
+    cv::Point2d predicted = center_ + velocity_;
+    double width = size_.width * params_.searchScale;
+    double height = size_.height * params_.searchScale;
+    cv::Rect search = cv::Rect(cvRound(predicted.x - width / 2.0), cvRound(predicted.y - height / 2.0), cvRound(width), cvRound(height))
+        & cv::Rect(0, 0, frame.cols, frame.rows);
+    if (search.empty()) {
+        center_ = predicted;
+        return false;
+    }
+
+    cv::Mat window = frame(search);
+    WindowMoments moments = (frame.channels() == 1) ? window_moments<1>(window) : window_moments<3>(window);
+    if (moments.m00 < params_.minArea) {
+        //coast on the prediction so the droplet can be picked up again next frame
+        center_ = predicted;
+        return false;
+    }
+
+    cv::Point2d centroid(search.x + (double)moments.m10 / moments.m00, search.y + (double)moments.m01 / moments.m00);
+    velocity_ = velocity_ * (1.0 - params_.velocitySmoothing) + (centroid - center_) * params_.velocitySmoothing;
+    center_ = centroid;
+
+    boundingBox = cv::Rect(cvRound(center_.x - size_.width / 2.0), cvRound(center_.y - size_.height / 2.0), size_.width, size_.height);
+    return true;
+}
+
+cv::Rect CentroidTracker::predict() const {
+    cv::Point2d predicted = center_ + velocity_;
+    return cv::Rect(cvRound(predicted.x - size_.width / 2.0), cvRound(predicted.y - size_.height / 2.0), size_.width, size_.height);
+}
+cv::Point2d CentroidTracker::get_velocity() const {
+    return velocity_;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+#include "opencv2/tracking.hpp"
+
+//tracks a bright blob on an already foreground-masked image by taking the centroid of the nonzero
+//pixels in a search window around the constant-velocity prediction of its position
+class CentroidTracker : public cv::Tracker {
+public:
+	struct Params {
+		Params();
+
+		//search window size relative to the bounding box
+		float searchScale;
+		//fewer foreground pixels than this in the window counts as lost
+		int minArea;
+		//weight of the newest displacement in the smoothed velocity
+		float velocitySmoothing;
+	};
+
+	static cv::Ptr<CentroidTracker> create(const Params & parameters = Params());
+
+	explicit CentroidTracker(const Params & parameters);
+
+	void init(cv::InputArray image, const cv::Rect & boundingBox) override;
+	bool update(cv::InputArray image, cv::Rect & boundingBox) override;
+
+	//predicted bounding box for the next update
+	cv::Rect predict() const;
+	cv::Point2d get_velocity() const;
+private:
+	Params params_;
+	cv::Point2d center_;
+	cv::Point2d velocity_;
+	cv::Size size_;
+};
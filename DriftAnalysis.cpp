@@ -0,0 +1,254 @@
+#include "DriftAnalysis.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+    const double NOT_AVAILABLE = std::numeric_limits<double>::quiet_NaN();
+    const double PI = 3.14159265358979323846;
+}
+
+DriftAnalysis::Params::Params() :
+    plateVolts(500.0),
+    plateSpacing(7.6e-3),
+    oilDensity(886.0),
+    airDensity(1.2),
+    airViscosity(1.827e-5),
+    gravity(9.81),
+    slipLength(8.1e-8),
+    invertedImage(false),
+    minSamples(5)
+{}
+
+DriftAnalysis::DriftAnalysis(const Params & parameters) : params_(parameters), metresPerPixel_(0.0), fps_(0.0) {}
+
+void DriftAnalysis::set_params(const Params & parameters) {
+    if (parameters == params_) {
+        return;
+    }
+    params_ = parameters;
+    std::fill(fitted_.begin(), fitted_.end(), 0);
+}
+
+void DriftAnalysis::set_scale(const Calibration & calibration, double fps) {
+    //the rule markings are tenths of a millimetre apart
+    double metresPerPixel = (calibration.pixels > 0.0) ? calibration.tenthsOfMm * 1e-4 / calibration.pixels : 0.0;
+    if ((metresPerPixel == metresPerPixel_) && (fps == fps_)) {
+        return;
+    }
+    metresPerPixel_ = metresPerPixel;
+    fps_ = fps;
+    std::fill(fitted_.begin(), fitted_.end(), 0);
+}
+
+void DriftAnalysis::set_keyframes(const std::vector<size_t> & keyframes) {
+    std::vector<size_t> sorted = keyframes;
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    if (sorted == keyframes_) {
+        return;
+    }
+    keyframes_.swap(sorted);
+    std::fill(fitted_.begin(), fitted_.end(), 0);
+}
+
+size_t DriftAnalysis::update(const TrackStore & tracks) {
+    size_t count = tracks.track_count();
+    fitted_.resize(count, 0);
+    segments_.resize(count);
+    estimates_.resize(count);
+
+    size_t refitted = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t revision = tracks.revision(i);
+        if (fitted_[i] != revision) {
+            fit_track_(tracks, i);
+            fitted_[i] = revision;
+            refitted++;
+        }
+    }
+    return refitted;
+}
+
+size_t DriftAnalysis::track_count() const {
+    return segments_.size();
+}
+const std::vector<SegmentFit> & DriftAnalysis::segments(size_t track) const {
+    return segments_[track];
+}
+const DropletEstimate & DriftAnalysis::estimate(size_t track) const {
+    return estimates_[track];
+}
+
+void DriftAnalysis::fit_track_(const TrackStore & tracks, size_t track) {
+    std::vector<SegmentFit> & fits = segments_[track];
+    fits.clear();
+    TrackStore::Columns columns = tracks.columns(track);
+    if ((tracks.count(track) == 0) || (metresPerPixel_ <= 0.0) || (fps_ <= 0.0)) {
+        estimates_[track] = estimate_(fits);
+        return;
+    }
+
+    //the keyframes cut the track's frame range into segments, before the first and after the last included
+    size_t begin = columns.first;
+    size_t end = columns.first + columns.length;
+    auto keyframe = std::upper_bound(keyframes_.begin(), keyframes_.end(), begin);
+    while (begin < end) {
+        size_t next = ((keyframe != keyframes_.end()) && (*keyframe < end)) ? *keyframe++ : end;
+        fit_segment_(columns, begin, next, fits);
+        begin = next;
+    }
+    estimates_[track] = estimate_(fits);
+}
+
+void DriftAnalysis::fit_segment_(const TrackStore::Columns & columns, size_t first, size_t last, std::vector<SegmentFit> & fits) const {
+    Sums sums{};
+    accumulate_(columns, first - columns.first, last - columns.first, sums);
+    if (sums.n < (double)std::max<size_t>(params_.minSamples, 3)) {
+        return;
+    }
+
+    //t runs from 0 at the segment start, which keeps the sums small enough for doubles to stay exact
+    double denominator = sums.n * sums.tt - sums.t * sums.t;
+    if (denominator <= 0.0) {
+        return;
+    }
+    double slope = (sums.n * sums.ty - sums.t * sums.y) / denominator;
+    double intercept = (sums.y - slope * sums.t) / sums.n;
+    double residual = std::max(0.0, sums.yy - intercept * sums.y - slope * sums.ty);
+    double slopeError = std::sqrt(residual / (sums.n - 2.0) * sums.n / denominator);
+
+    //y is twice the centre in pixels, image rows grow downward
+    double scale = 0.5 * metresPerPixel_ * fps_ * (params_.invertedImage ? -1.0 : 1.0);
+    SegmentFit fit;
+    fit.firstFrame = first;
+    fit.lastFrame = last;
+    fit.samples = (size_t)sums.n;
+    fit.velocity = slope * scale;
+    fit.velocityError = slopeError * std::abs(scale);
+    fit.direction = (std::abs(fit.velocity) <= 2.0 * fit.velocityError) ? 0 : ((fit.velocity > 0.0) ? 1 : -1);
+    fits.push_back(fit);
+}
+
+void DriftAnalysis::accumulate_(const TrackStore::Columns & columns, size_t begin, size_t end, Sums & sums) {
+    //boxes are walked a validity word at a time: full words go through a loop without branches or
+    //masks that the compiler vectorises, partly filled ones weight each frame by its bit, empty ones
+    //are skipped. the accumulators are per call, the loops only touch the y and height columns
+    const int16_t * y = columns.y;
+    const int16_t * height = columns.height;
+    double n = 0.0, t = 0.0, tt = 0.0, sy = 0.0, ty = 0.0, yy = 0.0;
+    for (size_t word = begin / 64; word * 64 < end; word++) {
+        size_t from = std::max(begin, word * 64);
+        size_t to = std::min(end, word * 64 + 64);
+        uint64_t bits = columns.valid[word];
+        if ((from != word * 64) || (to != word * 64 + 64)) {
+            uint64_t span = ((to - word * 64 == 64) ? ~(uint64_t)0 : (((uint64_t)1 << (to - word * 64)) - 1)) & ~(((uint64_t)1 << (from - word * 64)) - 1);
+            bits &= span;
+        }
+        if (bits == 0) {
+            continue;
+        }
+
+        if (bits == ~(uint64_t)0) {
+            for (size_t i = from; i < to; i++) {
+                double ti = (double)(i - begin);
+                double yi = 2.0 * y[i] + height[i];
+                n += 1.0;
+                t += ti;
+                tt += ti * ti;
+                sy += yi;
+                ty += ti * yi;
+                yy += yi * yi;
+            }
+        }
+        else {
+            for (size_t i = from; i < to; i++) {
+                double wi = (double)((bits >> (i - word * 64)) & 1);
+                double ti = (double)(i - begin);
+                double yi = 2.0 * y[i] + height[i];
+                n += wi;
+                t += wi * ti;
+                tt += wi * ti * ti;
+                sy += wi * yi;
+                ty += wi * ti * yi;
+                yy += wi * yi * yi;
+            }
+        }
+    }
+    sums.n += n;
+    sums.t += t;
+    sums.tt += tt;
+    sums.y += sy;
+    sums.ty += ty;
+    sums.yy += yy;
+}
+
+DropletEstimate DriftAnalysis::estimate_(const std::vector<SegmentFit> & fits) const {
+    //segments of each direction are averaged weighted by their samples
+    double fall = 0.0, fallSamples = 0.0, rise = 0.0, riseSamples = 0.0;
+    for (const SegmentFit & fit : fits) {
+        if (fit.direction > 0) {
+            fall += fit.velocity * fit.samples;
+            fallSamples += fit.samples;
+        }
+        else if (fit.direction < 0) {
+            rise -= fit.velocity * fit.samples;
+            riseSamples += fit.samples;
+        }
+    }
+
+    DropletEstimate estimate{ NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE };
+    if (fallSamples > 0.0) {
+        estimate.fallVelocity = fall / fallSamples;
+    }
+    if (riseSamples > 0.0) {
+        estimate.riseVelocity = rise / riseSamples;
+    }
+    if (!(estimate.fallVelocity > estimate.riseVelocity)) {
+        return estimate;
+    }
+
+    //4/3 pi r^3 (rho_oil - rho_air) g = 3 pi eta r (v_fall - v_rise) with eta / (1 + s / r) for eta
+    //gives r^2 + s r = 9 eta (v_fall - v_rise) / (4 (rho_oil - rho_air) g)
+    const Params & p = params_;
+    double buoyantDensity = p.oilDensity - p.airDensity;
+    double area = 9.0 * p.airViscosity * (estimate.fallVelocity - estimate.riseVelocity) / (4.0 * buoyantDensity * p.gravity);
+    double s = p.slipLength;
+    estimate.radius = std::sqrt(s * s / 4.0 + area) - s / 2.0;
+
+    //2 q E = 6 pi eta r (v_fall + v_rise)
+    double viscosity = p.airViscosity / (1.0 + s / estimate.radius);
+    double field = p.plateVolts / p.plateSpacing;
+    estimate.charge = 3.0 * PI * viscosity * estimate.radius * (estimate.fallVelocity + estimate.riseVelocity) / field;
+    estimate.elementaryCharges = estimate.charge / ELEMENTARY_CHARGE;
+    return estimate;
+}
+
+void save_drift_analysis(const std::string & path, const DriftAnalysis & analysis) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to create analysis file: " + path);
+    }
+    out.precision(6);
+
+    out << "drop#\tfirst frame\tlast frame\tsamples\tvelocity (m/s)\tvelocity error (m/s)\tdirection\n";
+    for (size_t i = 0; i < analysis.track_count(); i++) {
+        for (const SegmentFit & fit : analysis.segments(i)) {
+            out << i << '\t' << fit.firstFrame << '\t' << fit.lastFrame << '\t' << fit.samples << '\t'
+                << fit.velocity << '\t' << fit.velocityError << '\t' << fit.direction << '\n';
+        }
+    }
+
+    out << "\ndrop#\tfall velocity (m/s)\trise velocity (m/s)\tradius (m)\tcharge (C)\tcharge (e)\n";
+    for (size_t i = 0; i < analysis.track_count(); i++) {
+        const DropletEstimate & estimate = analysis.estimate(i);
+        if (std::isnan(estimate.charge)) {
+            continue;
+        }
+        out << i << '\t' << estimate.fallVelocity << '\t' << estimate.riseVelocity << '\t' << estimate.radius << '\t'
+            << estimate.charge << '\t' << estimate.elementaryCharges << '\n';
+    }
+}
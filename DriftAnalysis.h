@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Calibration.h"
+#include "TrackStore.h"
+
+//straight line fit of one droplet's vertical position over the frames between two keyframes, where the
+//field is constant. velocities are in m/s and positive when the droplet falls
+struct SegmentFit {
+	//frames [firstFrame, lastFrame) of the segment, the keyframes being where the field was switched
+	size_t firstFrame;
+	size_t lastFrame;
+	size_t samples;
+	double velocity;
+	//standard error of velocity from the scatter about the line
+	double velocityError;
+	//+1 falling, -1 rising, 0 if the velocity is within two standard errors of 0
+	int direction;
+};
+
+//radius and charge of a droplet from its mean falling and rising speed, NaN where a direction was never
+//fitted or the speeds are inconsistent, e.g. rising faster than falling
+struct DropletEstimate {
+	double fallVelocity;
+	double riseVelocity;
+	//metres and coulombs
+	double radius;
+	double charge;
+	double elementaryCharges;
+};
+
+//drift velocities and charges of every droplet by the field reversal method: with the field pushing
+//down the drag balances mg + qE, pushed up it balances qE - mg, so the speeds give mg and qE and Stokes'
+//law turns mg into a radius. positions are box centres scaled by the calibration and frame rate.
+//each segment is fitted in one pass over the track's coordinate columns, and results are cached per
+//track, so update only refits tracks whose boxes changed since the last one
+class DriftAnalysis {
+public:
+	//apparatus and air, SI units
+	struct Params {
+		Params();
+
+		double plateVolts;
+		double plateSpacing;
+		double oilDensity;
+		double airDensity;
+		double airViscosity;
+		double gravity;
+		//Cunningham slip correction, the viscosity is divided by 1 + slipLength / radius. b / p with
+		//b = 8.2e-3 Pa m at atmospheric pressure, 0 applies none
+		double slipLength;
+		//the eyepiece camera sees the chamber upside down
+		bool invertedImage;
+		//boxes a segment needs to be fitted
+		size_t minSamples;
+
+		bool operator==(const Params &) const = default;
+	};
+
+	explicit DriftAnalysis(const Params & parameters = Params());
+
+	//the setters refit every track at the next update if they change anything
+	void set_params(const Params & parameters);
+	//pixel scale from the calibration and frames per second
+	void set_scale(const Calibration & calibration, double fps);
+	//frames where the field was switched, in any order
+	void set_keyframes(const std::vector<size_t> & keyframes);
+	//brings the fits in line with tracks. returns the number of tracks refitted
+	size_t update(const TrackStore & tracks);
+
+	size_t track_count() const;
+	const std::vector<SegmentFit> & segments(size_t track) const;
+	const DropletEstimate & estimate(size_t track) const;
+
+	static constexpr double ELEMENTARY_CHARGE = 1.602176634e-19;
+private:
+	//sums of a least squares line fit, t being the frame and y twice the box centre
+	struct Sums {
+		double n, t, tt, y, ty, yy;
+	};
+
+	void fit_track_(const TrackStore & tracks, size_t track);
+	void fit_segment_(const TrackStore::Columns & columns, size_t first, size_t last, std::vector<SegmentFit> & fits) const;
+	static void accumulate_(const TrackStore::Columns & columns, size_t begin, size_t end, Sums & sums);
+	DropletEstimate estimate_(const std::vector<SegmentFit> & fits) const;
+
+	Params params_;
+	double metresPerPixel_;
+	double fps_;
+	std::vector<size_t> keyframes_;
+
+	//TrackStore::revision(track) when each track was last fitted, 0 forces a refit
+	std::vector<uint64_t> fitted_;
+	std::vector<std::vector<SegmentFit>> segments_;
+	std::vector<DropletEstimate> estimates_;
+};
+
+//tab separated, one row per fitted segment followed by one row per droplet with an estimate. throws
+//std::runtime_error if the file cannot be created
+void save_drift_analysis(const std::string & path, const DriftAnalysis & analysis);
@@ -1,17 +1,68 @@
-#pragma once
-
-#include <unordered_map>
-
-#include "opencv2/tracking.hpp"
-
-struct Droplet {
-public:
-	Droplet() : active(false), frameLastUpdated(0) {}
-
-	std::unordered_map<size_t, cv::Rect> bbox;
-
-	//tracker info
-	bool active;
-	cv::Ptr<cv::Tracker> tracker;
-	size_t frameLastUpdated;
+#pragma once
+
+#include <vector>
+
+#include "opencv2/tracking.hpp"
+
+#include "MotionFilter.h"
+
+//what a tracker droplet needs to resume tracking at a frame without the operator drawing its box again
+struct TrackerCheckpoint {
+	size_t frame;
+	//box in roi_ coordinates, the tracker is started on it again when it cannot be copied
+	cv::Rect box;
+	//copy of the tracker where its type allows it, e.g. CentroidTracker, otherwise empty
+	cv::Ptr<cv::Tracker> tracker;
+	MotionFilter motion;
+	size_t lockedFrames;
+	cv::Rect trackerBox;
+	float trackerArea;
+	cv::Point2f centroidOffset;
+};
+
+struct Droplet {
+public:
+	Droplet() : active(false), createTracker(nullptr), frameLastUpdated(0), trackedUntil(0), trackerStale(false), lockedFrames(0), trackerArea(0.0f), detected(false), missedFrames(0) {}
+
+	//forget the motion model, when the tracker is replaced
+	void reset_motion() {
+		motion = MotionFilter();
+		lockedFrames = 0;
+	}
+
+	//the droplet's boxes live in MillikanTracker's TrackStore under the same index
+
+	//tracker info
+	bool active;
+	cv::Ptr<cv::Tracker> tracker;
+	//makes a tracker of the type the droplet was created with, used when it is reset
+	cv::Ptr<cv::Tracker> (*createTracker)();
+	size_t frameLastUpdated;
+	//last frame the tracker put a box on, boxes after a correction up to here are stale
+	size_t trackedUntil;
+	//bulk re-tracking moved frameLastUpdated past where the tracker is, it restarts from the last checkpoint
+	bool trackerStale;
+	//sorted by frame, one where the tracker was started and then one every CHECKPOINT_INTERVAL frames
+	std::vector<TrackerCheckpoint> checkpoints;
+
+	//motion model of the tracker's box centre in roi_ coordinates and the frames it has agreed with the
+	//tracker in a row. the box the tracker itself last returned, with the foreground area inside it and
+	//the offset from the mask centroid to the box centre, describe the droplet when the tracker is skipped
+	MotionFilter motion;
+	size_t lockedFrames;
+	cv::Rect trackerBox;
+	float trackerArea;
+	cv::Point2f centroidOffset;
+
+	//full resolution box size and offset from the mask centroid to the box centre when the tracker was
+	//started, for placing boxes of trackers that run on a coarser pyramid level
+	cv::Size boxSize;
+	cv::Point2f refineOffset;
+
+	//tracks created by the detector have no tracker and are continued by association instead
+	bool detected;
+	cv::Point2f center;
+	cv::Point2f velocity;
+	cv::Size size;
+	size_t missedFrames;
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "DropletDetector.h"
+
+#include <algorithm>
+
+#include "opencv2/imgproc.hpp"
+
+DropletDetector::Params::Params() : minArea(6), maxArea(2000), gateDistance(20.0f), maxMissed(5), padding(4) {}
+
+DropletDetector::DropletDetector(const Params & parameters) : params_(parameters) {}
+
+const std::vector<Detection> & DropletDetector::detect(const cv::Mat & fgMask) {
+    int labels = cv::connectedComponentsWithStats(fgMask, labels_, stats_, centroids_, 8, CV_32S);
+
+    detections_.clear();
+    for (int i = 1; i < labels; i++) {
+        const int * stats = stats_.ptr<int>(i);
+        int area = stats[cv::CC_STAT_AREA];
+        if ((area < params_.minArea) || (area > params_.maxArea)) {
+            continue;
+        }
+
+        const double * centroid = centroids_.ptr<double>(i);
+        detections_.push_back({
+            cv::Rect(stats[cv::CC_STAT_LEFT], stats[cv::CC_STAT_TOP], stats[cv::CC_STAT_WIDTH], stats[cv::CC_STAT_HEIGHT]),
+            cv::Point2f(centroid[0], centroid[1]),
+            area
+        });
+    }
+
+    matched_.assign(detections_.size(), false);
+    return detections_;
+}
+
+void DropletDetector::associate(const std::vector<cv::Point2f> & predictions, std::vector<size_t> & assignment) {
+    float gate2 = params_.gateDistance * params_.gateDistance;
+
+    candidates_.clear();
+    for (size_t t = 0; t < predictions.size(); t++) {
+        for (size_t d = 0; d < detections_.size(); d++) {
+            if (matched_[d]) {
+                continue;
+            }
+            cv::Point2f offset = detections_[d].centroid - predictions[t];
+            float distance2 = offset.x * offset.x + offset.y * offset.y;
+            if (distance2 <= gate2) {
+                candidates_.push_back({ distance2, t, d });
+            }
+        }
+    }
+    std::sort(candidates_.begin(), candidates_.end(), [](const Candidate & a, const Candidate & b) {
+        return (a.distance2 < b.distance2) || ((a.distance2 == b.distance2) && ((a.track < b.track) || ((a.track == b.track) && (a.detection < b.detection))));
+    });
+
+    assignment.assign(predictions.size(), NO_MATCH);
+    for (const Candidate & candidate : candidates_) {
+        if ((assignment[candidate.track] == NO_MATCH) && !matched_[candidate.detection]) {
+            assignment[candidate.track] = candidate.detection;
+            matched_[candidate.detection] = true;
+        }
+    }
+}
+
+bool DropletDetector::is_matched(size_t detection) const {
+    return matched_[detection];
+}
+void DropletDetector::claim(size_t detection) {
+    matched_[detection] = true;
+}
+
+const DropletDetector::Params & DropletDetector::get_params() const {
+    return params_;
+}
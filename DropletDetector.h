@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+struct Detection {
+	cv::Rect box;
+	cv::Point2f centroid;
+	int area;
+};
+
+//proposes droplets as connected components of the foreground mask and matches them to existing tracks.
+//all buffers are members and are reused, so after the first few frames nothing is allocated per frame
+class DropletDetector {
+public:
+	struct Params {
+		Params();
+
+		//components outside this pixel area range are ignored
+		int minArea;
+		int maxArea;
+		//largest distance in pixels between a track's predicted centre and a detection it can take
+		float gateDistance;
+		//frames a detected track may go unmatched before it is retired
+		size_t maxMissed;
+		//pixels added around a new detection's component box
+		int padding;
+	};
+
+	explicit DropletDetector(const Params & parameters = Params());
+
+	const std::vector<Detection> & detect(const cv::Mat & fgMask);
+
+	//globally greedy gated assignment of the last detections to the predicted track centres: all
+	//pairs within the gate are taken in order of increasing distance. assignment[i] is the detection
+	//matched to track i or NO_MATCH
+	void associate(const std::vector<cv::Point2f> & predictions, std::vector<size_t> & assignment);
+	bool is_matched(size_t detection) const;
+	//stop a detection from seeding a new track, e.g. when it lies inside a manually tracked droplet
+	void claim(size_t detection);
+
+	const Params & get_params() const;
+
+	static const size_t NO_MATCH = -1;
+private:
+	struct Candidate {
+		float distance2;
+		size_t track;
+		size_t detection;
+	};
+
+	Params params_;
+	cv::Mat labels_, stats_, centroids_;
+	std::vector<Detection> detections_;
+	std::vector<Candidate> candidates_;
+	std::vector<char> matched_;
+};
@@ -0,0 +1,159 @@
+#include "FrameCache.h"
+
+#include <algorithm>
+
+#include "opencv2/videoio.hpp"
+
+FrameCache::FrameCache(size_t budgetBytes) : bytes_(0), hasPending_(false), budgetBytes_(budgetBytes), hits_(0), misses_(0) {}
+
+void FrameCache::set_budget(size_t budgetBytes) {
+    settle_();
+    budgetBytes_ = budgetBytes;
+    while ((entries_.size() > 2) && (bytes_ > budgetBytes_)) {
+        bytes_ -= entries_.back().bytes;
+        lookup_.erase(entries_.back().frame);
+        entries_.pop_back();
+    }
+}
+size_t FrameCache::get_budget() const {
+    return budgetBytes_;
+}
+
+FrameCache::Entry * FrameCache::find(size_t frame) {
+    settle_();
+    auto it = lookup_.find(frame);
+    if (it == lookup_.end()) {
+        misses_++;
+        return nullptr;
+    }
+
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    pending_ = entries_.begin();
+    hasPending_ = true;
+    return &entries_.front();
+}
+
+FrameCache::Entry & FrameCache::acquire(size_t frame) {
+    settle_();
+    auto it = lookup_.find(frame);
+    if (it != lookup_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        pending_ = entries_.begin();
+        hasPending_ = true;
+        return entries_.front();
+    }
+
+    //the front entry is the one on screen, so at least two entries are always kept. a recycled entry
+    //keeps its buffers and so stays counted
+    if ((entries_.size() >= 2) && (bytes_ + entries_.back().bytes > budgetBytes_)) {
+        lookup_.erase(entries_.back().frame);
+        entries_.splice(entries_.begin(), entries_, std::prev(entries_.end()));
+    }
+    else {
+        entries_.emplace_front();
+        entries_.front().bytes = 0;
+    }
+
+    Entry & entry = entries_.front();
+    entry.frame = frame;
+    entry.hasProcessed = false;
+    lookup_[frame] = entries_.begin();
+    pending_ = entries_.begin();
+    hasPending_ = true;
+    return entry;
+}
+
+bool FrameCache::contains(size_t frame) const {
+    return lookup_.contains(frame);
+}
+
+void FrameCache::erase(size_t frame) {
+    settle_();
+    auto it = lookup_.find(frame);
+    if (it != lookup_.end()) {
+        bytes_ -= it->second->bytes;
+        entries_.erase(it->second);
+        lookup_.erase(it);
+    }
+}
+
+void FrameCache::clear() {
+    entries_.clear();
+    lookup_.clear();
+    bytes_ = 0;
+    hasPending_ = false;
+}
+
+size_t FrameCache::size() const {
+    return entries_.size();
+}
+size_t FrameCache::size_bytes() const {
+    return hasPending_ ? bytes_ - pending_->bytes + entry_bytes_(*pending_) : bytes_;
+}
+size_t FrameCache::hits() const {
+    return hits_;
+}
+size_t FrameCache::misses() const {
+    return misses_;
+}
+
+size_t FrameCache::entry_bytes_(const Entry & entry) {
+    return entry.source.total() * entry.source.elemSize()
+        + entry.fgMask.total() * entry.fgMask.elemSize()
+        + entry.processed.total() * entry.processed.elemSize();
+}
+
+void FrameCache::settle_() {
+    if (hasPending_) {
+        size_t bytes = entry_bytes_(*pending_);
+        bytes_ = bytes_ - pending_->bytes + bytes;
+        pending_->bytes = bytes;
+        hasPending_ = false;
+    }
+}
+
+KeyframeIndex::KeyframeIndex() : ready_(false) {}
+
+void KeyframeIndex::build(const std::string & videoPath, const std::atomic<bool> & cancel) {
+    clear();
+
+    //with CAP_PROP_FORMAT -1 grab() only demuxes packets, which is far cheaper than decoding them
+    cv::VideoCapture raw(videoPath, cv::CAP_FFMPEG, { cv::CAP_PROP_FORMAT, -1 });
+    if (!raw.isOpened()) {
+        return;
+    }
+
+    std::vector<size_t> keyframes;
+    for (size_t frame = 0; !cancel && raw.grab(); frame++) {
+        if (raw.get(cv::CAP_PROP_LRF_HAS_KEY_FRAME) != 0) {
+            keyframes.push_back(frame);
+        }
+    }
+    if (cancel || keyframes.empty() || (keyframes.front() != 0)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    keyframes_ = std::move(keyframes);
+    ready_ = true;
+}
+
+void KeyframeIndex::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    keyframes_.clear();
+    ready_ = false;
+}
+
+bool KeyframeIndex::ready() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_;
+}
+
+size_t KeyframeIndex::keyframe_before(size_t frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ready_) {
+        return frame;
+    }
+    return *(std::upper_bound(keyframes_.begin(), keyframes_.end(), frame) - 1);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+//least recently used cache of decoded frames around the playhead, bounded by a memory budget.
+//evicted entries are recycled so their buffers are decoded into again without reallocating
+class FrameCache {
+public:
+	struct Entry {
+		size_t frame;
+		cv::Mat source, fgMask, processed;
+		//fgMask and processed are rebuilt lazily for frames only decoded on the way to another frame
+		bool hasProcessed;
+		//buffer bytes counted in the cache's total, brought up to date when the next entry is handed out
+		size_t bytes;
+	};
+
+	FrameCache(size_t budgetBytes = 0);
+
+	void set_budget(size_t budgetBytes);
+	size_t get_budget() const;
+
+	//counts a hit or miss, a hit becomes the most recently used entry
+	Entry * find(size_t frame);
+	//entry for frame at the front of the cache, either new or recycled from the least recently used one.
+	//the buffers of a recycled entry are left in place to be overwritten
+	Entry & acquire(size_t frame);
+	bool contains(size_t frame) const;
+	void erase(size_t frame);
+	void clear();
+
+	size_t size() const;
+	size_t size_bytes() const;
+	size_t hits() const;
+	size_t misses() const;
+private:
+	static size_t entry_bytes_(const Entry & entry);
+	//callers fill the buffers of the entry last returned by find or acquire, which is counted again here
+	void settle_();
+
+	std::list<Entry> entries_;
+	std::unordered_map<size_t, std::list<Entry>::iterator> lookup_;
+	//running total of the entries' bytes, so eviction does not walk the cache
+	size_t bytes_;
+	std::list<Entry>::iterator pending_;
+	bool hasPending_;
+	size_t budgetBytes_;
+	size_t hits_, misses_;
+};
+
+//positions of the container keyframes, found by demuxing the video without decoding it
+class KeyframeIndex {
+public:
+	KeyframeIndex();
+
+	//blocking, returns early if cancel is set. leaves the index empty if the backend cannot report keyframes
+	void build(const std::string & videoPath, const std::atomic<bool> & cancel);
+	void clear();
+
+	bool ready();
+	//closest keyframe at or before frame, or frame itself if the index is not ready
+	size_t keyframe_before(size_t frame);
+private:
+	std::mutex mutex_;
+	std::vector<size_t> keyframes_;
+	bool ready_;
+};
@@ -0,0 +1,242 @@
+#include "Journal.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include "MappedFile.h"
+
+namespace {
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t reserved;
+    };
+
+    const char MAGIC[4] = { 'J', 'R', 'N', 'L' };
+}
+
+Journal::Journal() : records_(0), generation_(0), open_(false), stop_(false) {}
+
+void Journal::open(const std::string & path) {
+    close();
+
+    {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        path_ = path;
+        write_header_();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_ = 0;
+    open_ = true;
+    stop_ = false;
+    error_.clear();
+    flusher_ = std::thread(&Journal::run_, this);
+}
+
+void Journal::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!open_) {
+            return;
+        }
+        stop_ = true;
+    }
+    wake_.notify_all();
+    flusher_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_ = false;
+    file_.close();
+}
+
+bool Journal::is_open() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return open_;
+}
+
+void Journal::set_box(size_t track, size_t frame, const cv::Rect & box) {
+    append_(SET_BOX, track, frame, box);
+}
+void Journal::erase_box(size_t track, size_t frame) {
+    append_(ERASE_BOX, track, frame, cv::Rect());
+}
+void Journal::mark_keyframe(size_t frame) {
+    append_(MARK_KEYFRAME, 0, frame, cv::Rect());
+}
+void Journal::unmark_keyframe(size_t frame) {
+    append_(UNMARK_KEYFRAME, 0, frame, cv::Rect());
+}
+
+void Journal::reset() {
+    std::lock_guard<std::mutex> fileLock(fileMutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_) {
+        return;
+    }
+
+    pending_.clear();
+    records_ = 0;
+    generation_++;
+    write_header_();
+}
+
+size_t Journal::record_count() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_;
+}
+std::string Journal::get_error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+size_t Journal::replay(const std::string & path, TrackStore & tracks, std::unordered_set<int> & keyframes) {
+    if (!std::filesystem::exists(path) || (std::filesystem::file_size(path) == 0)) {
+        return 0;
+    }
+
+    MappedFile file(path);
+    Header header;
+    if (file.size() < sizeof(header)) {
+        return 0;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+    if ((std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) || (header.version != VERSION)) {
+        throw std::runtime_error("Not a version " + std::to_string(VERSION) + " journal: " + path);
+    }
+
+    //a crash can leave a partial record at the end, which fails the size or the checksum test
+    size_t count = (file.size() - sizeof(Header)) / sizeof(Record);
+    const unsigned char * data = file.data() + sizeof(Header);
+    size_t applied = 0;
+    for (; applied < count; applied++) {
+        Record record;
+        std::memcpy(&record, data + applied * sizeof(Record), sizeof(Record));
+        if (record.check != checksum_(record)) {
+            break;
+        }
+
+        switch (record.type) {
+        case SET_BOX:
+            if (tracks.track_count() <= record.track) {
+                tracks.resize(record.track + 1);
+            }
+            tracks.set(record.track, record.frame, cv::Rect(record.x, record.y, record.width, record.height));
+            break;
+        case ERASE_BOX:
+            if (record.track < tracks.track_count()) {
+                tracks.erase(record.track, record.frame);
+            }
+            break;
+        case MARK_KEYFRAME:
+            keyframes.insert((int)record.frame);
+            break;
+        case UNMARK_KEYFRAME:
+            keyframes.erase((int)record.frame);
+            break;
+        }
+    }
+    return applied;
+}
+
+Journal::~Journal() {
+    close();
+}
+
+void Journal::append_(Type type, size_t track, size_t frame, const cv::Rect & box) {
+    Record record{};
+    record.type = type;
+    record.track = (uint32_t)track;
+    record.frame = frame;
+    record.x = cv::saturate_cast<int16_t>(box.x);
+    record.y = cv::saturate_cast<int16_t>(box.y);
+    record.width = cv::saturate_cast<int16_t>(box.width);
+    record.height = cv::saturate_cast<int16_t>(box.height);
+    record.check = checksum_(record);
+    bool clamped = (record.x != box.x) || (record.y != box.y) || (record.width != box.width) || (record.height != box.height);
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!open_) {
+            return;
+        }
+        if (clamped) {
+            fail_("Box of droplet " + std::to_string(track) + " at frame " + std::to_string(frame) + " is outside the 16 bit coordinate range and was clamped");
+        }
+        pending_.push_back(record);
+        records_++;
+        full = (pending_.size() >= FLUSH_RECORDS);
+    }
+    if (full) {
+        wake_.notify_one();
+    }
+}
+
+void Journal::run_() {
+    //the buffers are swapped, so the editing thread appends into the one written out the time before
+    std::vector<Record> writing;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this]() { return stop_ || (pending_.size() >= FLUSH_RECORDS); });
+        bool stopping = stop_;
+        uint64_t generation = generation_;
+        writing.swap(pending_);
+        lock.unlock();
+
+        bool failed = false;
+        if (!writing.empty()) {
+            std::lock_guard<std::mutex> fileLock(fileMutex_);
+            //records taken before a reset are already part of the snapshot that reset the journal
+            if (generation == generation_) {
+                file_.write((const char *)writing.data(), writing.size() * sizeof(Record));
+                file_.flush();
+                failed = !file_;
+            }
+        }
+        writing.clear();
+
+        lock.lock();
+        if (failed) {
+            fail_("Failed to write journal: " + path_);
+        }
+        if (stopping && pending_.empty()) {
+            break;
+        }
+    }
+}
+
+void Journal::write_header_() {
+    file_.close();
+    file_.open(path_, std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+        throw std::runtime_error("Failed to create journal: " + path_);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    file_.write((const char *)&header, sizeof(header));
+    file_.flush();
+    if (!file_) {
+        throw std::runtime_error("Failed to write journal: " + path_);
+    }
+}
+
+void Journal::fail_(const std::string & error) {
+    if (error_.empty()) {
+        error_ = error;
+    }
+}
+
+uint32_t Journal::checksum_(const Record & record) {
+    const unsigned char * bytes = (const unsigned char *)&record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(Record, check); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+#include "TrackStore.h"
+
+//append-only log of the edits made to a session's tracks and keyframes since its last snapshot:
+//	header | record...
+//records are fixed size and carry a checksum, so replay stops cleanly at a record torn by a crash.
+//appending only copies the record into a buffer, a background thread writes the buffer out every
+//FLUSH_INTERVAL_MS or once it holds FLUSH_RECORDS records
+class Journal {
+public:
+	enum Type : uint8_t {
+		SET_BOX = 1,
+		ERASE_BOX = 2,
+		MARK_KEYFRAME = 3,
+		UNMARK_KEYFRAME = 4
+	};
+
+	Journal();
+
+	Journal(const Journal &) = delete;
+	Journal & operator=(const Journal &) = delete;
+
+	//starts a new, empty journal at path
+	void open(const std::string & path);
+	//writes out everything appended so far and stops the flush thread
+	void close();
+	bool is_open() const;
+
+	//appends are ignored while the journal is closed
+	void set_box(size_t track, size_t frame, const cv::Rect & box);
+	void erase_box(size_t track, size_t frame);
+	void mark_keyframe(size_t frame);
+	void unmark_keyframe(size_t frame);
+
+	//empties the journal, for when everything in it has been saved in a snapshot
+	void reset();
+	//records appended since the journal was opened or last reset
+	size_t record_count() const;
+	//the first problem since the journal was opened, empty if there was none: a write that failed, after
+	//which edits are no longer recovered after a crash, or a box beyond the 16 bit range of a record,
+	//which is journaled clamped the way the TrackStore keeps it
+	std::string get_error() const;
+
+	//applies the intact records of the journal at path to tracks and keyframes and returns how many there
+	//were. a missing or empty journal applies nothing
+	static size_t replay(const std::string & path, TrackStore & tracks, std::unordered_set<int> & keyframes);
+
+	~Journal();
+
+	static const uint32_t VERSION = 1;
+	static constexpr int FLUSH_INTERVAL_MS = 250;
+	static const size_t FLUSH_RECORDS = 4096;
+private:
+	struct Record {
+		uint8_t type;
+		uint8_t reserved[3];
+		uint32_t track;
+		uint64_t frame;
+		int16_t x, y, width, height;
+		//FNV-1a of the bytes before it
+		uint32_t check;
+		uint32_t padding;
+	};
+
+	void append_(Type type, size_t track, size_t frame, const cv::Rect & box);
+	//keeps the first error, under mutex_
+	void fail_(const std::string & error);
+	void run_();
+	void write_header_();
+	static uint32_t checksum_(const Record & record);
+
+	std::string path_;
+	std::ofstream file_;
+	std::thread flusher_;
+
+	//pending_ is filled by the editing thread and swapped out by the flusher, both under mutex_
+	mutable std::mutex mutex_;
+	std::condition_variable wake_;
+	std::vector<Record> pending_;
+	size_t records_;
+	//bumped by reset under both locks, so the flusher can drop a batch it took before the reset
+	uint64_t generation_;
+	bool open_;
+	bool stop_;
+	std::string error_;
+	//taken by the flusher while it writes and by reset while it truncates, never while holding mutex_
+	std::mutex fileMutex_;
+};
@@ -0,0 +1,388 @@
+#include "LiveSession.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+
+#include "opencv2/highgui.hpp"
+#include "opencv2/imgproc.hpp"
+
+#include "BackgroundModels.h"
+
+namespace {
+    double milliseconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    cv::Point2f box_center(const cv::Rect & box) {
+        return cv::Point2f(box.x + box.width / 2.0f, box.y + box.height / 2.0f);
+    }
+}
+
+std::ostream & operator<<(std::ostream & out, const LiveStats & stats) {
+    return out << "live: " << stats.captured << " frames captured, " << stats.processed << " processed, "
+        << stats.decimated << " decimated, " << stats.dropped << " dropped, " << stats.expired << " expired, "
+        << stats.meanLatencyMs << " ms mean and " << stats.maxLatencyMs << " ms max latency, decimation "
+        << stats.decimation << " at the end, " << stats.tracks << " tracks";
+}
+
+LiveSession::LiveSession(const std::string & source, const std::string & outputPath, const SessionOptions & options, const LiveOptions & live) :
+    outputPath_(outputPath),
+    options_(options),
+    live_(live),
+    fileRate_(false),
+    paced_(false),
+    fps_(0.0),
+    slots_(std::max<size_t>(1, live.queueDepth)),
+    stop_(false),
+    finished_(false),
+    decimation_(1),
+    backSub_(create_background_model(options.backgroundModel, options.backgroundParams)),
+    detector_(options.detector),
+    costMs_(0.0),
+    intervalMs_(0.0),
+    lastIndex_(0),
+    latencySumMs_(0.0),
+    previewFps_(0.0),
+    previewFresh_(false),
+    displayFps_(0.0),
+    stats_{}
+{
+    bool device = !source.empty() && std::all_of(source.begin(), source.end(), [](unsigned char c) { return std::isdigit(c); });
+    if (device) {
+        source_.open(std::stoi(source));
+    }
+    else {
+        source_.open(source);
+    }
+    if (!source_.isOpened()) {
+        throw std::runtime_error("Failed to open video source: " + source);
+    }
+
+    //devices often report no rate or a nominal one, the interval between frames is measured instead
+    fps_ = source_.get(cv::CAP_PROP_FPS);
+    fileRate_ = !device && std::filesystem::is_regular_file(source) && (fps_ > 0.0);
+    paced_ = live_.paceFiles && fileRate_;
+    writer_ = std::make_unique<TsvTrackWriter>(outputPath_ + ".txt");
+    stats_.decimation = 1;
+}
+
+void LiveSession::run() {
+    freeSlots_ = std::make_unique<SpscQueue<size_t>>(slots_.size());
+    readySlots_ = std::make_unique<SpscQueue<size_t>>(slots_.size() + 1);
+    for (size_t i = 0; i < slots_.size(); i++) {
+        freeSlots_->push(i);
+    }
+
+    stop_ = false;
+    finished_ = false;
+    processThread_ = std::thread(&LiveSession::process_, this);
+    captureThread_ = std::thread(&LiveSession::capture_, this);
+
+    //the UI thread only shows what processing last finished, it never holds up the pipeline
+    if (!options_.headless) {
+        cv::namedWindow(options_.windowName);
+        while (!finished_) {
+            show_preview_();
+            int keyCode = cv::waitKey(PREVIEW_WAIT_MS);
+            if ((keyCode == 27) || (keyCode == 'q')) {
+                stop();
+            }
+        }
+        cv::destroyWindow(options_.windowName);
+    }
+
+    captureThread_.join();
+    processThread_.join();
+
+    for (size_t i = 0; i < droplets_.size(); i++) {
+        if (droplets_[i].active) {
+            report_(i);
+        }
+    }
+    writer_->close();
+    if (!tracks_.empty()) {
+        save_tracks_binary(outputPath_ + ".trk", tracks_);
+    }
+
+    stats_.meanLatencyMs = (stats_.processed > 0) ? latencySumMs_ / stats_.processed : 0.0;
+    stats_.decimation = decimation_;
+    stats_.tracks = droplets_.size();
+
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void LiveSession::stop() {
+    stop_ = true;
+}
+
+const LiveStats & LiveSession::get_stats() const {
+    return stats_;
+}
+
+LiveSession::~LiveSession() {
+    stop_ = true;
+    if (captureThread_.joinable()) {
+        captureThread_.join();
+    }
+    if (processThread_.joinable()) {
+        processThread_.join();
+    }
+}
+
+void LiveSession::capture_() {
+    try {
+        //a file is replayed on the schedule a camera would deliver it on, however long processing takes
+        Clock::time_point start = Clock::now();
+        Clock::duration period = paced_ ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps_)) : Clock::duration::zero();
+        size_t index = 0;
+        while (!stop_) {
+            if (paced_) {
+                std::this_thread::sleep_until(start + period * index);
+            }
+            //every frame is grabbed so the source never buffers up, only the processed ones are decoded
+            if (!source_.grab()) {
+                break;
+            }
+            Clock::time_point captured = Clock::now();
+            index++;
+            stats_.captured++;
+
+            if (index % decimation_ != 0) {
+                stats_.decimated++;
+                continue;
+            }
+            size_t slot;
+            if (!freeSlots_->try_pop(slot)) {
+                stats_.dropped++;
+                continue;
+            }
+            Slot & s = slots_[slot];
+            if (!source_.retrieve(s.frame)) {
+                freeSlots_->push(slot);
+                break;
+            }
+            s.index = index;
+            s.captured = captured;
+            readySlots_->push(slot);
+        }
+    }
+    catch (...) {
+        fail_();
+    }
+    //there is always room, the queue holds every slot and the end marker
+    readySlots_->push(END_OF_STREAM);
+}
+
+void LiveSession::process_() {
+    try {
+        size_t slot;
+        while (readySlots_->pop(slot, stop_) && (slot != END_OF_STREAM)) {
+            Slot & s = slots_[slot];
+            Clock::time_point begin = Clock::now();
+
+            if (lastIndex_ != 0) {
+                double interval = milliseconds(s.captured - lastCaptured_) / (s.index - lastIndex_);
+                intervalMs_ = (intervalMs_ == 0.0) ? interval : intervalMs_ + SMOOTHING * (interval - intervalMs_);
+            }
+            lastIndex_ = s.index;
+            lastCaptured_ = s.captured;
+
+            //a frame that cannot be finished within the budget gives way to the newer ones behind it. the
+            //newest is always processed, so a budget below the cost of a frame still leaves some output
+            if ((milliseconds(begin - s.captured) + costMs_ > live_.latencyBudgetMs) && !readySlots_->empty()) {
+                stats_.expired++;
+                freeSlots_->push(slot);
+                continue;
+            }
+
+            if (roi_.empty()) {
+                cv::Rect frameRect(0, 0, s.frame.cols, s.frame.rows);
+                roi_ = options_.roi.empty() ? frameRect : (options_.roi & frameRect);
+                if (roi_.empty()) {
+                    roi_ = frameRect;
+                }
+            }
+            cv::Mat region = (roi_.size() == s.frame.size()) ? s.frame : s.frame(roi_);
+            if (options_.grayscale && (region.channels() == 3)) {
+                cv::cvtColor(region, prepared_, cv::COLOR_BGR2GRAY);
+            }
+            else {
+                prepared_ = region;
+            }
+            backSub_->apply(prepared_, rawMask_);
+            kernels_.median5(rawMask_, fgMask_);
+
+            track_(s.index);
+            writer_->flush();
+
+            Clock::time_point done = Clock::now();
+            double latency = milliseconds(done - s.captured);
+            stats_.processed++;
+            latencySumMs_ += latency;
+            stats_.maxLatencyMs = std::max(stats_.maxLatencyMs, latency);
+            adapt_decimation_(milliseconds(done - begin));
+
+            //the frame is only copied when the preview has taken the previous one
+            if (!options_.headless) {
+                std::lock_guard<std::mutex> lock(previewMutex_);
+                if (!previewFresh_) {
+                    s.frame.copyTo(previewFrame_);
+                    previewBoxes_.clear();
+                    cv::Rect box;
+                    for (size_t i = 0; i < droplets_.size(); i++) {
+                        if (droplets_[i].active && tracks_.get(i, s.index, box)) {
+                            previewBoxes_.push_back({ box, droplets_[i].velocity });
+                        }
+                    }
+                    previewFps_ = frame_rate_();
+                    previewFresh_ = true;
+                }
+            }
+
+            freeSlots_->push(slot);
+        }
+    }
+    catch (...) {
+        fail_();
+    }
+    finished_ = true;
+}
+
+void LiveSession::track_(size_t frame) {
+    //detections are in roi_ coordinates, droplet centres and boxes in full frame coordinates
+    const std::vector<Detection> & detections = detector_.detect(fgMask_);
+    cv::Point2f offset(roi_.tl());
+
+    //frames may have been skipped since a droplet was last seen, so it is predicted over the gap
+    activeTracks_.clear();
+    predictions_.clear();
+    for (size_t i = 0; i < droplets_.size(); i++) {
+        Droplet & droplet = droplets_[i];
+        if (droplet.active) {
+            activeTracks_.push_back(i);
+            predictions_.push_back(droplet.center + droplet.velocity * (float)(frame - droplet.frameLastUpdated) - offset);
+        }
+    }
+
+    detector_.associate(predictions_, assignment_);
+
+    for (size_t j = 0; j < activeTracks_.size(); j++) {
+        size_t track = activeTracks_[j];
+        Droplet & droplet = droplets_[track];
+        size_t d = assignment_[j];
+        if (d != DropletDetector::NO_MATCH) {
+            cv::Point2f center = detections[d].centroid + offset;
+            droplet.velocity = (center - droplet.center) * (1.0f / (frame - droplet.frameLastUpdated));
+            droplet.center = center;
+            droplet.missedFrames = 0;
+            droplet.frameLastUpdated = frame;
+            cv::Rect box(cvRound(center.x - droplet.size.width / 2.0), cvRound(center.y - droplet.size.height / 2.0), droplet.size.width, droplet.size.height);
+            tracks_.set(track, frame, box);
+            writer_->write(track, frame, box);
+        }
+        else if (++droplet.missedFrames > detector_.get_params().maxMissed) {
+            droplet.active = false;
+            report_(track);
+        }
+    }
+
+    int padding = detector_.get_params().padding;
+    for (size_t d = 0; d < detections.size(); d++) {
+        if (detector_.is_matched(d)) {
+            continue;
+        }
+
+        cv::Rect box(roi_.x + detections[d].box.x - padding, roi_.y + detections[d].box.y - padding, detections[d].box.width + 2 * padding, detections[d].box.height + 2 * padding);
+        droplets_.emplace_back();
+        size_t track = tracks_.add_track();
+        Droplet & droplet = droplets_.back();
+        droplet.active = true;
+        droplet.detected = true;
+        droplet.center = detections[d].centroid + offset;
+        droplet.velocity = cv::Point2f(0, 0);
+        droplet.size = box.size();
+        droplet.frameLastUpdated = frame;
+        tracks_.set(track, frame, box);
+        writer_->write(track, frame, box);
+    }
+}
+
+void LiveSession::report_(size_t track) {
+    TrackStore::Columns columns = tracks_.columns(track);
+    size_t last = droplets_[track].frameLastUpdated;
+    cv::Rect first, end;
+    if ((last <= columns.first) || !tracks_.get(track, columns.first, first) || !tracks_.get(track, last, end)) {
+        return;
+    }
+
+    double fps = frame_rate_();
+    cv::Point2f velocity = (box_center(end) - box_center(first)) * (float)(fps / (last - columns.first));
+    std::cout << "drop " << track << ": frames " << columns.first << " to " << last << ", velocity ("
+        << velocity.x << ", " << velocity.y << ") px/s" << std::endl;
+}
+
+void LiveSession::adapt_decimation_(double costMs) {
+    costMs_ = (costMs_ == 0.0) ? costMs : costMs_ + SMOOTHING * (costMs - costMs_);
+    if (intervalMs_ <= 0.0) {
+        return;
+    }
+
+    //a processed frame may take decimation source intervals. skipping evenly keeps the track sampled at a
+    //steady rate where dropping alone would leave bursts of gaps. the two thresholds keep it from
+    //flipping between neighbouring values
+    size_t decimation = decimation_;
+    if ((costMs_ > HIGH_LOAD * decimation * intervalMs_) && (decimation < live_.maxDecimation)) {
+        decimation++;
+    }
+    else if ((decimation > 1) && (costMs_ < LOW_LOAD * (decimation - 1) * intervalMs_)) {
+        decimation--;
+    }
+    decimation_ = decimation;
+}
+
+double LiveSession::frame_rate_() const {
+    //devices report a nominal rate if any, which is only used until an interval has been measured
+    if (fileRate_ || (intervalMs_ <= 0.0)) {
+        return fps_;
+    }
+    return 1000.0 / intervalMs_;
+}
+
+void LiveSession::show_preview_() {
+    {
+        std::lock_guard<std::mutex> lock(previewMutex_);
+        if (!previewFresh_) {
+            return;
+        }
+        //the buffers change hands, so the next frame is copied into the one shown before
+        std::swap(display_, previewFrame_);
+        std::swap(displayBoxes_, previewBoxes_);
+        displayFps_ = previewFps_;
+        previewFresh_ = false;
+    }
+
+    for (const PreviewBox & preview : displayBoxes_) {
+        cv::rectangle(display_, preview.box, cv::Scalar(0, 255, 0));
+        std::string speed = std::to_string((int)std::round(preview.velocity.y * displayFps_)) + " px/s";
+        cv::putText(display_, speed, cv::Point(preview.box.x, preview.box.y - 4), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0));
+    }
+    if (options_.previewScale != 1.0) {
+        cv::resize(display_, display_, cv::Size(), options_.previewScale, options_.previewScale, cv::INTER_AREA);
+    }
+    cv::imshow(options_.windowName, display_);
+}
+
+void LiveSession::fail_() {
+    {
+        std::lock_guard<std::mutex> lock(errorMutex_);
+        if (!error_) {
+            error_ = std::current_exception();
+        }
+    }
+    stop_ = true;
+}
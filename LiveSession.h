@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/core.hpp"
+#include "opencv2/video.hpp"
+#include "opencv2/videoio.hpp"
+
+#include "Droplet.h"
+#include "DropletDetector.h"
+#include "MaskKernels.h"
+#include "MillikanTracker.h"
+#include "SpscQueue.h"
+#include "TrackFile.h"
+#include "TrackStore.h"
+
+struct LiveOptions {
+	//longest time from a frame's capture to its track rows being written. frames that could not make
+	//it are dropped unprocessed instead of delaying every later one
+	double latencyBudgetMs = 100.0;
+	//frames captured and waiting for processing, a frame arriving to a full queue is dropped
+	size_t queueDepth = 4;
+	//under sustained overload only every nth frame is processed, up to this n
+	size_t maxDecimation = 8;
+	//files are replayed at the frame rate stored in them, as a stand-in for a camera. devices and pipes
+	//deliver at their own rate
+	bool paceFiles = true;
+};
+
+//where every captured frame went, and the end-to-end latency of the processed ones
+struct LiveStats {
+	size_t captured;
+	size_t processed;
+	//skipped by decimation, dropped at a full queue, or too old by the time processing reached them
+	size_t decimated;
+	size_t dropped;
+	size_t expired;
+	double meanLatencyMs;
+	double maxLatencyMs;
+	//decimation in effect at the end
+	size_t decimation;
+	size_t tracks;
+};
+
+std::ostream & operator<<(std::ostream & out, const LiveStats & stats);
+
+//tracks droplets online from a camera, pipe or file, e.g. during the experiment. a capture thread
+//timestamps every frame and hands it to a processing thread, which runs background subtraction and
+//automatic detection in capture order and writes each box to <outputPath>.txt as soon as it exists.
+//boxes keep the frame number of the source, so velocities stay right when frames are skipped.
+//the session never falls behind the source: under overload it processes only every nth frame, and
+//drops the frames that arrive to a full queue or would exceed the latency budget
+class LiveSession {
+public:
+	//source is a device number, or a file, URL or pipeline cv::VideoCapture can open. only detection
+	//tracks droplets, the roi, grayscale, background model and detector of options apply
+	LiveSession(const std::string & source, const std::string & outputPath, const SessionOptions & options = SessionOptions(), const LiveOptions & live = LiveOptions());
+
+	LiveSession(const LiveSession &) = delete;
+	LiveSession & operator=(const LiveSession &) = delete;
+
+	//captures and tracks until the source ends or stop() is called, showing the latest processed frame
+	//with its boxes and speeds unless headless. Esc or q in the window stops. <outputPath>.trk is
+	//written at the end
+	void run();
+	void stop();
+
+	const LiveStats & get_stats() const;
+
+	~LiveSession();
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Slot {
+		cv::Mat frame;
+		//1-based frame number of the source
+		size_t index;
+		Clock::time_point captured;
+	};
+
+	void capture_();
+	void process_();
+	void track_(size_t frame);
+	//prints a finished track's mean velocity
+	void report_(size_t track);
+	//one frame's cost decides how many frames are skipped between processed ones
+	void adapt_decimation_(double costMs);
+	//source frames per second for velocities, on the processing thread
+	double frame_rate_() const;
+	void show_preview_();
+	//records the first exception of either thread and stops both
+	void fail_();
+
+	std::string outputPath_;
+	SessionOptions options_;
+	LiveOptions live_;
+
+	cv::VideoCapture source_;
+	//files were recorded at the rate stored in them, for other sources it is measured
+	bool fileRate_;
+	bool paced_;
+	double fps_;
+	cv::Rect roi_;
+
+	std::vector<Slot> slots_;
+	std::unique_ptr<SpscQueue<size_t>> freeSlots_, readySlots_;
+	std::thread captureThread_, processThread_;
+	std::atomic<bool> stop_;
+	std::atomic<bool> finished_;
+	std::atomic<size_t> decimation_;
+
+	//processing state, owned by the processing thread
+	cv::Ptr<cv::BackgroundSubtractor> backSub_;
+	MaskKernels kernels_;
+	cv::Mat prepared_, rawMask_, fgMask_;
+	DropletDetector detector_;
+	std::vector<Droplet> droplets_;
+	std::vector<size_t> activeTracks_;
+	std::vector<cv::Point2f> predictions_;
+	std::vector<size_t> assignment_;
+	TrackStore tracks_;
+	std::unique_ptr<TsvTrackWriter> writer_;
+	//mean cost of processing a frame and mean time between source frames
+	double costMs_;
+	double intervalMs_;
+	size_t lastIndex_;
+	Clock::time_point lastCaptured_;
+	double latencySumMs_;
+
+	//latest processed frame and its boxes for the preview, guarded by previewMutex_
+	struct PreviewBox {
+		cv::Rect box;
+		cv::Point2f velocity;
+	};
+	std::mutex previewMutex_;
+	cv::Mat previewFrame_;
+	std::vector<PreviewBox> previewBoxes_;
+	double previewFps_;
+	bool previewFresh_;
+	//what the UI thread shows, swapped with the above
+	cv::Mat display_;
+	std::vector<PreviewBox> displayBoxes_;
+	double displayFps_;
+
+	std::mutex errorMutex_;
+	std::exception_ptr error_;
+
+	LiveStats stats_;
+
+	static const size_t END_OF_STREAM = -1;
+	//weight of the newest sample in the running means of cost and frame interval
+	static constexpr double SMOOTHING = 0.1;
+	//share of the frame interval processing may use before more frames are skipped, and the share
+	//below which fewer are
+	static constexpr double HIGH_LOAD = 0.8;
+	static constexpr double LOW_LOAD = 0.6;
+	static const int PREVIEW_WAIT_MS = 15;
+};
@@ -0,0 +1,138 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+    data_(nullptr),
+    size_(0),
+#ifdef _WIN32
+    file_(INVALID_HANDLE_VALUE),
+    mapping_(nullptr)
+#else
+    fd_(-1)
+#endif
+{}
+
+MappedFile::MappedFile(const std::string & path) : MappedFile() {
+    open(path);
+}
+
+MappedFile::MappedFile(MappedFile && other) noexcept : MappedFile() {
+    swap_(other);
+}
+MappedFile & MappedFile::operator=(MappedFile && other) noexcept {
+    if (this != &other) {
+        close();
+        swap_(other);
+    }
+    return *this;
+}
+
+void MappedFile::open(const std::string & path) {
+    close();
+
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file_, &fileSize);
+    size_ = fileSize.QuadPart;
+
+    if (size_ > 0) {
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_ == nullptr) {
+            close();
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+        data_ = (const unsigned char *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open file: " + path);
+    }
+
+    struct stat fileStat;
+    fstat(fd_, &fileStat);
+    size_ = fileStat.st_size;
+
+    if (size_ > 0) {
+        void * mapped = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (mapped == MAP_FAILED) {
+            close();
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+        data_ = (const unsigned char *)mapped;
+    }
+#endif
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_ != nullptr) {
+        CloseHandle(mapping_);
+    }
+    if (file_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
+    }
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (data_ != nullptr) {
+        munmap((void *)data_, size_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = -1;
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
+
+bool MappedFile::is_open() const {
+#ifdef _WIN32
+    return file_ != INVALID_HANDLE_VALUE;
+#else
+    return fd_ >= 0;
+#endif
+}
+const unsigned char * MappedFile::data() const {
+    return data_;
+}
+size_t MappedFile::size() const {
+    return size_;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+void MappedFile::swap_(MappedFile & other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+#ifdef _WIN32
+    std::swap(file_, other.file_);
+    std::swap(mapping_, other.mapping_);
+#else
+    std::swap(fd_, other.fd_);
+#endif
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+//read-only memory mapping of a whole file
+class MappedFile {
+public:
+	MappedFile();
+	explicit MappedFile(const std::string & path);
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+	MappedFile(MappedFile && other) noexcept;
+	MappedFile & operator=(MappedFile && other) noexcept;
+
+	void open(const std::string & path);
+	void close();
+
+	bool is_open() const;
+	const unsigned char * data() const;
+	size_t size() const;
+
+	~MappedFile();
+private:
+	void swap_(MappedFile & other) noexcept;
+
+	const unsigned char * data_;
+	size_t size_;
+#ifdef _WIN32
+	void * file_;
+	void * mapping_;
+#else
+	int fd_;
+#endif
+};
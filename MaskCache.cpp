@@ -0,0 +1,272 @@
+#include "MaskCache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace {
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint64_t frameCount;
+        uint64_t indexOffset;
+    };
+
+    const char MAGIC[4] = { 'M', 'S', 'K', 'C' };
+
+    void put_varint(std::vector<unsigned char> & out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back((unsigned char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((unsigned char)value);
+    }
+
+    bool get_varint(const unsigned char *& data, const unsigned char * end, uint64_t & value) {
+        value = 0;
+        for (int shift = 0; (data != end) && (shift < 64); shift += 7) {
+            unsigned char byte = *data++;
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //length of the run of zero bytes starting at data, scanning a word at a time
+    size_t zero_run(const unsigned char * data, size_t length) {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            if (word != 0) {
+                break;
+            }
+        }
+        while ((i < length) && (data[i] == 0)) {
+            i++;
+        }
+        return i;
+    }
+
+    size_t nonzero_run(const unsigned char * data, size_t length) {
+        size_t i = 0;
+        while ((i < length) && (data[i] != 0)) {
+            i++;
+        }
+        return i;
+    }
+}
+
+MaskCache::MaskCache() : end_(0) {}
+
+void MaskCache::create(const std::string & path, cv::Size frameSize) {
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.open(path, std::ios::binary | std::ios::trunc);
+    if (!writer_.is_open()) {
+        throw std::runtime_error("Failed to create mask cache: " + path);
+    }
+
+    Header header{};
+    writer_.write((const char *)&header, sizeof(header));
+
+    path_ = path;
+    frameSize_ = frameSize;
+    end_ = sizeof(Header);
+}
+
+void MaskCache::write(size_t frame, const cv::Mat & mask) {
+    thread_local std::vector<unsigned char> encoded;
+    encode(mask, encoded);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.write((const char *)encoded.data(), encoded.size());
+    if (index_.size() <= frame) {
+        index_.resize(frame + 1, Entry{ 0, 0 });
+    }
+    index_[frame] = { end_, encoded.size() };
+    end_ += encoded.size();
+}
+
+void MaskCache::finish() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!writer_.is_open()) {
+        return;
+    }
+
+    writer_.write((const char *)index_.data(), index_.size() * sizeof(Entry));
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.width = frameSize_.width;
+    header.height = frameSize_.height;
+    header.frameCount = index_.size();
+    header.indexOffset = end_;
+    writer_.seekp(0);
+    writer_.write((const char *)&header, sizeof(header));
+    writer_.close();
+}
+
+void MaskCache::open(const std::string & path) {
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    load_(path);
+}
+
+void MaskCache::move_to(const std::string & path) {
+    finish();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    //unmapped first, a mapped file cannot be renamed or deleted everywhere
+    mapping_.reset();
+    std::error_code error;
+    std::filesystem::rename(path_, path, error);
+    if (error && std::filesystem::exists(path)) {
+        std::filesystem::remove(path_, error);
+        error.clear();
+    }
+    load_(error ? path_ : path);
+}
+
+void MaskCache::load_(const std::string & path) {
+    mapping_ = std::make_shared<MappedFile>(path);
+
+    Header header;
+    if (mapping_->size() < sizeof(header)) {
+        mapping_.reset();
+        throw std::runtime_error("Truncated mask cache: " + path);
+    }
+    std::memcpy(&header, mapping_->data(), sizeof(header));
+    if ((std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) || (header.version != VERSION)) {
+        mapping_.reset();
+        throw std::runtime_error("Not a version " + std::to_string(VERSION) + " mask cache: " + path);
+    }
+    if (header.indexOffset + header.frameCount * sizeof(Entry) > mapping_->size()) {
+        mapping_.reset();
+        throw std::runtime_error("Truncated mask cache: " + path);
+    }
+
+    path_ = path;
+    frameSize_ = cv::Size(header.width, header.height);
+    index_.resize(header.frameCount);
+    std::memcpy(index_.data(), mapping_->data() + header.indexOffset, header.frameCount * sizeof(Entry));
+    end_ = header.indexOffset;
+}
+
+void MaskCache::close() {
+    finish();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    mapping_.reset();
+    index_.clear();
+    path_.clear();
+    end_ = 0;
+}
+
+bool MaskCache::is_open() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !path_.empty();
+}
+
+bool MaskCache::contains(size_t frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (frame < index_.size()) && (index_[frame].size != 0);
+}
+
+bool MaskCache::read(size_t frame, cv::Mat & mask) {
+    Entry entry;
+    std::shared_ptr<MappedFile> mapping;
+    cv::Size frameSize;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if ((frame >= index_.size()) || (index_[frame].size == 0)) {
+            return false;
+        }
+
+        entry = index_[frame];
+        if (!mapping_ || (entry.offset + entry.size > mapping_->size())) {
+            //the record was written after the file was last mapped, so remap it at its current length
+            if (writer_.is_open()) {
+                writer_.flush();
+            }
+            mapping_ = std::make_shared<MappedFile>(path_);
+            if (entry.offset + entry.size > mapping_->size()) {
+                return false;
+            }
+        }
+        mapping = mapping_;
+        frameSize = frameSize_;
+    }
+
+    return decode(mapping->data() + entry.offset, entry.size, frameSize, mask);
+}
+
+size_t MaskCache::frame_count() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.size();
+}
+cv::Size MaskCache::frame_size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frameSize_;
+}
+size_t MaskCache::size_bytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return end_ + index_.size() * sizeof(Entry);
+}
+
+void MaskCache::encode(const cv::Mat & mask, std::vector<unsigned char> & encoded) {
+    CV_Assert(mask.type() == CV_8UC1);
+    encoded.clear();
+
+    //runs continue across row ends, so a continuous mask is just one long row
+    int rows = mask.isContinuous() ? 1 : mask.rows;
+    size_t rowLength = mask.isContinuous() ? mask.total() : mask.cols;
+
+    bool foreground = false;
+    uint64_t run = 0;
+    for (int r = 0; r < rows; r++) {
+        const unsigned char * row = mask.ptr<unsigned char>(r);
+        size_t i = 0;
+        while (i < rowLength) {
+            size_t length = foreground ? nonzero_run(row + i, rowLength - i) : zero_run(row + i, rowLength - i);
+            run += length;
+            i += length;
+            if (i < rowLength) {
+                put_varint(encoded, run);
+                run = 0;
+                foreground = !foreground;
+            }
+        }
+    }
+    put_varint(encoded, run);
+}
+
+bool MaskCache::decode(const unsigned char * data, size_t size, cv::Size frameSize, cv::Mat & mask) {
+    mask.create(frameSize, CV_8UC1);
+    if (!mask.isContinuous()) {
+        mask = cv::Mat(frameSize, CV_8UC1);
+    }
+
+    unsigned char * out = mask.ptr<unsigned char>();
+    size_t remaining = mask.total();
+    const unsigned char * end = data + size;
+    bool foreground = false;
+    while (remaining > 0) {
+        uint64_t run;
+        if (!get_varint(data, end, run) || (run > remaining)) {
+            return false;
+        }
+        std::memset(out, foreground ? 255 : 0, run);
+        out += run;
+        remaining -= run;
+        foreground = !foreground;
+    }
+    return true;
+}
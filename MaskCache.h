@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+#include "MappedFile.h"
+
+//foreground masks stored as run-length encoded records followed by a per-frame offset index:
+//	header | record... | index[frameCount]
+//a record is the alternating background/foreground run lengths of the row-major mask as LEB128 varints,
+//starting with a (possibly empty) background run
+class MaskCache {
+public:
+	MaskCache();
+
+	MaskCache(const MaskCache &) = delete;
+	MaskCache & operator=(const MaskCache &) = delete;
+
+	//start a new cache at path. frames can be read back while the cache is still being written
+	void create(const std::string & path, cv::Size frameSize);
+	//safe to call from several threads, frames may arrive in any order
+	void write(size_t frame, const cv::Mat & mask);
+	//append the index and header, after which the file can be reopened with open()
+	void finish();
+
+	//open a finished cache
+	void open(const std::string & path);
+	//moves a finished cache to path, reads stay valid throughout. if path already exists, e.g. because
+	//another process finished the same cache first, that file is used and this one is deleted
+	void move_to(const std::string & path);
+	void close();
+	bool is_open();
+
+	bool contains(size_t frame);
+	//decodes the mask of frame into mask (CV_8UC1, 0 or 255), false if the frame is not cached. only the
+	//index lookup is under the lock, so reads on several threads decode side by side
+	bool read(size_t frame, cv::Mat & mask);
+
+	size_t frame_count();
+	cv::Size frame_size();
+	size_t size_bytes();
+
+	static void encode(const cv::Mat & mask, std::vector<unsigned char> & encoded);
+	static bool decode(const unsigned char * data, size_t size, cv::Size frameSize, cv::Mat & mask);
+
+	static const uint32_t VERSION = 1;
+private:
+	struct Entry {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	void load_(const std::string & path);
+
+	std::string path_;
+	std::ofstream writer_;
+	//shared with the reads decoding from it, so remapping the growing file cannot unmap it under them
+	std::shared_ptr<MappedFile> mapping_;
+	std::mutex mutex_;
+	cv::Size frameSize_;
+	std::vector<Entry> index_;
+	uint64_t end_;
+};
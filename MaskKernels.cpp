@@ -0,0 +1,111 @@
+#include "MaskKernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    inline int clamp_row(int y, int rows) {
+        return std::min(std::max(y, 0), rows - 1);
+    }
+
+    template <int channels>
+    void masked_copy_row(const unsigned char * frame, const unsigned char * mask, unsigned char * out, int cols) {
+        for (int x = 0; x < cols; x++) {
+            unsigned char keep = (mask[x] != 0) ? 0xff : 0x00;
+            for (int c = 0; c < channels; c++) {
+                out[channels * x + c] = frame[channels * x + c] & keep;
+            }
+        }
+    }
+
+    void masked_copy_row(const unsigned char * frame, const unsigned char * mask, unsigned char * out, int cols, int channels) {
+        switch (channels) {
+        case 1:
+            masked_copy_row<1>(frame, mask, out, cols);
+            break;
+        case 3:
+            masked_copy_row<3>(frame, mask, out, cols);
+            break;
+        default:
+            for (int x = 0; x < cols; x++) {
+                unsigned char keep = (mask[x] != 0) ? 0xff : 0x00;
+                for (int c = 0; c < channels; c++) {
+                    out[channels * x + c] = frame[channels * x + c] & keep;
+                }
+            }
+        }
+    }
+}
+
+void MaskKernels::median5(const cv::Mat & mask, cv::Mat & out) {
+    run_(mask, out, nullptr, nullptr);
+}
+
+void MaskKernels::median5_masked_copy(const cv::Mat & mask, const cv::Mat & frame, cv::Mat & filtered, cv::Mat & processed) {
+    CV_Assert((frame.depth() == CV_8U) && (frame.rows == mask.rows) && (frame.cols == mask.cols));
+    processed.create(frame.size(), frame.type());
+    run_(mask, filtered, &frame, &processed);
+}
+
+void MaskKernels::masked_copy(const cv::Mat & frame, const cv::Mat & mask, cv::Mat & processed) {
+    CV_Assert((frame.depth() == CV_8U) && (mask.type() == CV_8UC1) && (frame.rows == mask.rows) && (frame.cols == mask.cols));
+    processed.create(frame.size(), frame.type());
+    for (int y = 0; y < frame.rows; y++) {
+        masked_copy_row(frame.ptr<unsigned char>(y), mask.ptr<unsigned char>(y), processed.ptr<unsigned char>(y), frame.cols, frame.channels());
+    }
+}
+
+void MaskKernels::run_(const cv::Mat & mask, cv::Mat & filtered, const cv::Mat * frame, cv::Mat * processed) {
+    CV_Assert(mask.type() == CV_8UC1);
+    filtered.create(mask.size(), CV_8UC1);
+    CV_Assert(filtered.data != mask.data);
+
+    int rows = mask.rows;
+    int cols = mask.cols;
+    int strips = (rows + STRIP_ROWS - 1) / STRIP_ROWS;
+    //per strip: running 5-row counts per column, padded by 2 replicated columns each side
+    size_t stripScratch = cols + 4;
+    if (scratch_.size() < strips * stripScratch) {
+        scratch_.resize(strips * stripScratch);
+    }
+
+    cv::parallel_for_(cv::Range(0, strips), [&](const cv::Range & range) {
+        for (int strip = range.start; strip < range.end; strip++) {
+            unsigned char * counts = scratch_.data() + strip * stripScratch;
+            unsigned char * column = counts + 2;
+            int begin = strip * STRIP_ROWS;
+            int end = std::min(begin + STRIP_ROWS, rows);
+
+            std::memset(column, 0, cols);
+            for (int dy = -2; dy <= 2; dy++) {
+                const unsigned char * in = mask.ptr<unsigned char>(clamp_row(begin + dy, rows));
+                for (int x = 0; x < cols; x++) {
+                    column[x] += (in[x] != 0);
+                }
+            }
+
+            for (int y = begin; y < end; y++) {
+                if (y != begin) {
+                    const unsigned char * entering = mask.ptr<unsigned char>(clamp_row(y + 2, rows));
+                    const unsigned char * leaving = mask.ptr<unsigned char>(clamp_row(y - 3, rows));
+                    for (int x = 0; x < cols; x++) {
+                        column[x] += (entering[x] != 0);
+                        column[x] -= (leaving[x] != 0);
+                    }
+                }
+                counts[0] = counts[1] = column[0];
+                column[cols] = column[cols + 1] = column[cols - 1];
+
+                unsigned char * out = filtered.ptr<unsigned char>(y);
+                for (int x = 0; x < cols; x++) {
+                    unsigned char sum = counts[x] + counts[x + 1] + counts[x + 2] + counts[x + 3] + counts[x + 4];
+                    out[x] = (sum >= 13) ? 255 : 0;
+                }
+
+                if (frame != nullptr) {
+                    masked_copy_row(frame->ptr<unsigned char>(y), out, processed->ptr<unsigned char>(y), cols, frame->channels());
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+//single pass, allocation-free replacements for the medianBlur and masked copy steps of preprocessing.
+//buffers are kept between calls, so after the first frame of a given size nothing is allocated
+class MaskKernels {
+public:
+	//out = 255 where at least 13 of the 25 pixels in the replicate-bordered 5x5 neighbourhood of mask are
+	//nonzero and 0 elsewhere. for an 8-bit mask that is exactly where cv::medianBlur(mask, 5) is nonzero.
+	//out must not share data with mask
+	void median5(const cv::Mat & mask, cv::Mat & out);
+	//median5 and a masked copy of frame into processed fused into one pass, each output row is copied
+	//while the filtered mask row is still in cache
+	void median5_masked_copy(const cv::Mat & mask, const cv::Mat & frame, cv::Mat & filtered, cv::Mat & processed);
+
+	//processed = frame where mask is nonzero, 0 elsewhere, in a single pass
+	static void masked_copy(const cv::Mat & frame, const cv::Mat & mask, cv::Mat & processed);
+private:
+	void run_(const cv::Mat & mask, cv::Mat & filtered, const cv::Mat * frame, cv::Mat * processed);
+
+	std::vector<unsigned char> scratch_;
+
+	//rows per strip, strips are filtered in parallel and each keeps its own running column counts
+	static const int STRIP_ROWS = 64;
+};
@@ -1,276 +1,1690 @@
-#include "MillikanTracker.h"
-
-#include <iostream>
-#include <fstream>
-
-MillikanTracker::MillikanTracker(const std::string & videoPath, const std::string & outputPath) :
-    flags_(SHOW_PROCESSED),
-    backSub_(cv::createBackgroundSubtractorMOG2()),
-    activeDropletInd_(NO_DROPLET),
-    outputPath_(outputPath)
-{
-    cv::namedWindow("millikan");
-    load_video(videoPath);
-}
-
-void MillikanTracker::load_video(const std::string & videoPath) {
-    video_.open(videoPath);
-
-    if (!video_.isOpened()) {
-        throw std::runtime_error("Failed to open video: " + videoPath);
-    }
-
-    cv::VideoWriter processedWriter;
-    processedWriter.open("./temp/processed1.mp4", cv::VideoWriter::fourcc('a', 'v', 'c', '1'), video_.get(cv::CAP_PROP_FPS), cv::Size(video_.get(cv::CAP_PROP_FRAME_WIDTH), video_.get(cv::CAP_PROP_FRAME_HEIGHT)));
-    while (video_.read(currentFrame_)) {
-        process_frame_();
-        processedWriter.write(processedFrame_);
-    }
-    processedWriter.release();
-
-    video_.set(cv::CAP_PROP_POS_FRAMES, 0);
-    video_.read(currentFrame_);
-
-    processedVideo_.open("./temp/processed1.mp4");
-    if (!video_.isOpened()) {
-        throw std::runtime_error("Failed to open processed video: ./temp/processed1.mp4");
-    }
-    processedVideo_.read(processedFrame_);
-}
-
-void MillikanTracker::show() {
-    cv::Mat overlayed_ = (flags_ & SHOW_PROCESSED) ? processedFrame_.clone() : currentFrame_.clone();
-
-    draw_overlay_(overlayed_);
-
-    cv::imshow("millikan", overlayed_);
-}
-
-void MillikanTracker::finish() {
-    bool dropDataToWrite = false;
-    for (size_t i = 0; (i < trackedDroplets_.size()) && !dropDataToWrite; i++) {
-        dropDataToWrite = !trackedDroplets_[i].bbox.empty();
-    }
-
-    if (dropDataToWrite) {
-        std::ofstream out(outputPath_ + ".txt");
-        out << "drop#\tframe\tx\ty\tS_x\tS_y" << std::endl;
-        for (size_t i = 0; i < trackedDroplets_.size(); i++) {
-            for (auto & [frame, bbox] : trackedDroplets_[i].bbox) {
-                double S_x = (double)(bbox.width) / 2.0;
-                double x = bbox.x + S_x;
-                double S_y = (double)(bbox.height) / 2.0;
-                double y = bbox.y + S_x;
-                out << i << '\t' << frame << '\t' << x << '\t' << y << '\t' << S_x << '\t' << S_y << std::endl;
-            }
-        }
-
-        out.close();
-    }
-
-    if (!keyframes_.empty()) {
-        std::ofstream keyframeFile(outputPath_ + ".kfr");
-        keyframeFile << "keyframe" << std::endl;
-        for (int keyframe : keyframes_) {
-            keyframeFile << keyframe << std::endl;
-        }
-        keyframeFile.close();
-    }
-}
-
-void MillikanTracker::prev_doplet() {
-    if ((activeDropletInd_ != 0) && (activeDropletInd_ != -1)) {
-        activeDropletInd_--;
-    }
-}
-void MillikanTracker::next_droplet() {
-    if (activeDropletInd_ < trackedDroplets_.size() - 1) {
-        activeDropletInd_++;
-    }
-}
-
-void MillikanTracker::disable_tracker() {
-    Droplet & activeDrop = trackedDroplets_[activeDropletInd_];
-
-    activeDrop.active = false;
-    activeDrop.bbox.erase(get_frame());
-    activeDrop.frameLastUpdated = get_frame();
-}
-void MillikanTracker::reset_tracker() {
-    if (activeDropletInd_ != NO_DROPLET) {
-        cv::Mat overlayed = processedFrame_.clone();
-        draw_overlay_(overlayed);
-        cv::Rect rect = cv::selectROI("millikan", overlayed, false, true);
-
-        if (!rect.empty()) {
-            auto & activeDrop = trackedDroplets_[activeDropletInd_];
-            activeDrop.active = true;
-            activeDrop.tracker = cv::TrackerCSRT::create();
-            activeDrop.tracker->init(processedFrame_, rect);
-            activeDrop.bbox[get_frame()] = rect;
-            activeDrop.frameLastUpdated = get_frame();
-        }
-    }
-}
-
-bool MillikanTracker::next_frame() {
-    if (video_.read(currentFrame_)) {
-        processedVideo_.read(processedFrame_);
-        update_trackers_();
-
-        return true;
-    }
-    else {
-        return false;
-    }
-}
-bool MillikanTracker::prev_frame() {
-    int frame = get_frame() - 2;
-
-    if (frame >= 0) {
-        video_.set(cv::CAP_PROP_POS_FRAMES, frame);
-        processedVideo_.set(cv::CAP_PROP_POS_FRAMES, frame);
-        return next_frame();
-    }
-
-    return false;
-}
-void MillikanTracker::beginning() {
-    video_.set(cv::CAP_PROP_POS_FRAMES, 0);
-    processedVideo_.set(cv::CAP_PROP_POS_FRAMES, 0);
-    next_frame();
-}
-
-void MillikanTracker::load_data(const std::string & dataFilepath) {
-    std::ifstream dataFile(dataFilepath);
-    std::string line;
-    std::getline(dataFile, line);
-    while (getline(dataFile, line)) {
-        std::stringstream linestream(line);
-        std::string token;
-
-        getline(linestream, token, '\t');
-        size_t droplet = std::stoull(token);
-
-        getline(linestream, token, '\t');
-        size_t frame = std::stoull(token);
-
-        getline(linestream, token, '\t');
-        double x = std::stold(token);
-
-        getline(linestream, token, '\t');
-        double y = std::stold(token);
-
-        getline(linestream, token, '\t');
-        double S_x = std::stold(token);
-
-        getline(linestream, token, '\t');
-        double S_y = std::stold(token);
-
-        if (trackedDroplets_.size() < droplet + 1) {
-            trackedDroplets_.resize(droplet + 1);
-        }
-        trackedDroplets_[droplet].active = false;
-        trackedDroplets_[droplet].frameLastUpdated = std::numeric_limits<size_t>::max();
-        trackedDroplets_[droplet].bbox[frame] = cv::Rect(x - S_x, y - S_x, 2 * S_x, 2 * S_y);
-
-        activeDropletInd_ = 0;
-    }
-    dataFile.close();
-}
-
-void MillikanTracker::load_keyframes(const std::string & keyframeFilepath) {
-    std::ifstream keyframeFile(keyframeFilepath);
-    std::string line;
-    getline(keyframeFile, line);
-    while (getline(keyframeFile, line)) {
-        keyframes_.insert(std::stol(line));
-    }
-    keyframeFile.close();
-}
-void MillikanTracker::mark_keyframe() {
-    keyframes_.insert(get_frame());
-}
-void MillikanTracker::unmark_keyframe() {
-    keyframes_.erase(get_frame());
-}
-bool MillikanTracker::is_keyframe() {
-    return keyframes_.contains(get_frame());
-}
-
-bool MillikanTracker::get_flag(unsigned char flag) {
-    return flags_ & flag;
-}
-void MillikanTracker::set_flag(unsigned char flag, bool value) {
-    if (value) {
-        flags_ |= flag;
-    }
-    else {
-        flags_ &= ~flag;
-    }
-}
-
-size_t MillikanTracker::get_frame() {
-    return video_.get(cv::CAP_PROP_POS_FRAMES);
-}
-
-MillikanTracker::~MillikanTracker() {
-    if (video_.isOpened()) {
-        video_.release();
-    }
-    if (processedVideo_.isOpened()) {
-        processedVideo_.release();
-    }
-
-    cv::destroyWindow("millikan");
-}
-
-void MillikanTracker::update_trackers_() {
-    for (size_t i = 0; i < trackedDroplets_.size(); i++) {
-        auto & activeDrop = trackedDroplets_[i];
-
-        if (activeDrop.frameLastUpdated < get_frame()) {
-            if (activeDrop.active) {
-                cv::Rect rect;
-                if (activeDrop.tracker->update(processedFrame_, rect)) {
-                    trackedDroplets_[i].bbox[get_frame()] = rect;
-                }
-            }
-            else {
-                activeDrop.bbox.erase(get_frame());
-            }
-            activeDrop.frameLastUpdated = get_frame();
-        }
-    }
-}
-
-void MillikanTracker::draw_overlay_(cv::Mat & image) {
-    cv::putText(image, "frame: " + std::to_string(get_frame()), cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 0, 255));
-    cv::putText(image, "active droplet: " + ((activeDropletInd_ == -1) ? "NONE" : std::to_string(activeDropletInd_)), cv::Point(10, 40), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 0, 255));
-    if (keyframes_.contains(get_frame())) {
-        cv::putText(image, "KEYFRAME", cv::Point(10, 60), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 255));
-    }
-
-    for (size_t i = 0; i < trackedDroplets_.size(); i++) {
-        auto & droplet = trackedDroplets_[i];
-        auto it = droplet.bbox.find(get_frame());
-        if (it != droplet.bbox.end()) {
-            cv::putText(image, std::to_string(i), cv::Point(it->second.x - 7, it->second.y + 2), cv::FONT_HERSHEY_SIMPLEX, 0.25, cv::Scalar(255, 0, 255));
-            if (i != activeDropletInd_) {
-                cv::rectangle(image, it->second, cv::Scalar(255, 0, 0), 1, cv::LINE_AA);
-            }
-            else {
-                cv::rectangle(image, it->second, cv::Scalar(0, 0, 255), 1, cv::LINE_AA);
-            }
-        }
-    }
-}
-
-void MillikanTracker::process_frame_() {
-    cv::Mat fgMask_;
-    backSub_->apply(currentFrame_, fgMask_);
-    cv::medianBlur(fgMask_, fgMask_, 5);
-
-    processedFrame_.release();
-    cv::bitwise_and(currentFrame_, currentFrame_, processedFrame_, fgMask_);
+#include "MillikanTracker.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "SpscQueue.h"
+#include "TrackFile.h"
+
+MillikanTracker::MillikanTracker(const std::string & videoPath, const std::string & outputPath, const SessionOptions & options) :
+    flags_(SHOW_PROCESSED),
+    options_(options),
+    frame_(0),
+    decodePos_(0),
+    backSub_(create_background_subtractor_()),
+    activeDropletInd_(NO_DROPLET),
+    trackerPool_((options.trackerThreads != 1) ? std::make_unique<ThreadPool>(options.trackerThreads) : nullptr),
+    detector_(options.detector),
+    detectorFrameLast_(0),
+    outputPath_(outputPath),
+    cancelPreprocess_(false),
+    playhead_(0),
+    preprocessDone_(true),
+    bulkDone_(true),
+    cancelBulk_(false),
+    unthrottled_(false)
+{
+    //the mask cache is named after the output so concurrent sessions on different videos do not collide
+    std::filesystem::create_directories("./temp");
+    maskCachePath_ = "./temp/" + std::filesystem::path(outputPath_).filename().string() + ".msk";
+    if (!options_.preprocessCacheDir.empty()) {
+        preprocessCache_ = std::make_unique<PreprocessCache>(options_.preprocessCacheDir, options_.preprocessCacheBytes);
+    }
+    journalPath_ = outputPath_ + ".jnl";
+
+    if (!options_.headless) {
+        cv::namedWindow(options_.windowName);
+    }
+    load_video(videoPath);
+}
+
+void MillikanTracker::load_video(const std::string & videoPath) {
+    stop_preprocessing_();
+
+    video_.open(videoPath);
+
+    if (!video_.isOpened()) {
+        throw std::runtime_error("Failed to open video: " + videoPath);
+    }
+    videoPath_ = videoPath;
+
+    frameCount_ = video_.get(cv::CAP_PROP_FRAME_COUNT);
+    fps_ = video_.get(cv::CAP_PROP_FPS);
+    decodePos_ = 0;
+    frameCache_.clear();
+    frameCache_.set_budget(options_.frameCacheBytes);
+    chunkReports_.clear();
+    trackerUsage_ = TrackerUsage{ 0, 0 };
+    segmentReports_.clear();
+    pipelineStats_.clear();
+
+    cv::Rect frameRect(0, 0, video_.get(cv::CAP_PROP_FRAME_WIDTH), video_.get(cv::CAP_PROP_FRAME_HEIGHT));
+    roi_ = options_.roi.empty() ? frameRect : (options_.roi & frameRect);
+    if (roi_.empty()) {
+        roi_ = frameRect;
+    }
+    trackingLevels_ = 0;
+    while ((options_.trackingWidth > 0) && ((roi_.width >> trackingLevels_) > options_.trackingWidth)) {
+        trackingLevels_++;
+    }
+    pyramidValid_ = false;
+
+    //masks of the same video and settings finished before, by any session, are reused as they are
+    bool cached = false;
+    if (preprocessCache_) {
+        preprocessKey_ = PreprocessCache::make_key(videoPath, preprocess_settings_());
+        std::string entry = preprocessCache_->find(preprocessKey_);
+        if (!entry.empty()) {
+            try {
+                maskCache_.open(entry);
+                cached = true;
+                std::cout << "mask cache: reusing " << entry << std::endl;
+            }
+            catch (const std::exception &) {
+                //evicted by another process since find, or damaged. either way it is rebuilt
+                std::error_code error;
+                std::filesystem::remove(entry, error);
+            }
+        }
+    }
+
+    //preprocessing runs ahead of the playhead in the background, next_frame only waits if it catches up
+    playhead_ = 0;
+    preprocessDone_ = cached;
+    preprocessError_ = nullptr;
+    cancelPreprocess_ = false;
+    unthrottled_ = false;
+    if (!cached) {
+        std::string path = maskCachePath_;
+        if (preprocessCache_) {
+            pendingCachePath_ = path = preprocessCache_->temporary_path(preprocessKey_);
+        }
+        maskCache_.create(path, roi_.size());
+        preprocessWorker_ = std::thread(&MillikanTracker::run_preprocessing_, this, videoPath);
+    }
+    keyframeIndexer_ = std::thread([this, videoPath]() {
+        keyframeIndex_.build(videoPath, cancelPreprocess_);
+    });
+
+    load_frame_(0);
+}
+
+void MillikanTracker::run_preprocessing_(std::string videoPath) {
+    try {
+        if (options_.chunks > 1) {
+            preprocess_chunked_(videoPath);
+        }
+        else {
+            preprocess_pipelined_(videoPath);
+        }
+        maskCache_.finish();
+
+        //only complete runs are published, a cancelled one stops wherever the playhead left it
+        if (!pendingCachePath_.empty() && !cancelPreprocess_) {
+            std::string entry = preprocessCache_->entry_path(preprocessKey_);
+            maskCache_.move_to(entry);
+            pendingCachePath_.clear();
+            preprocessCache_->evict(entry);
+        }
+
+        for (const StageStats & stats : pipelineStats_) {
+            std::cout << stats << std::endl;
+        }
+        for (const ChunkBoundaryReport & report : chunkReports_) {
+            std::cout << "chunk " << report.chunk << " boundary at frame " << report.startFrame << ": "
+                << (100.0 * report.meanMismatch) << "% mean, " << (100.0 * report.maxMismatch) << "% max mask mismatch over "
+                << report.framesCompared << " frames" << std::endl;
+        }
+        std::cout << "mask cache: " << maskCache_.frame_count() << " frames, " << maskCache_.size_bytes() << " bytes" << std::endl;
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+        preprocessError_ = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+        preprocessDone_ = true;
+    }
+    preprocessCv_.notify_all();
+}
+
+void MillikanTracker::stop_preprocessing_() {
+    cancel_preprocessing_();
+    //bulk workers waiting for masks are woken by the cancelled run finishing
+    stop_bulk_retrack_();
+    if (preprocessWorker_.joinable()) {
+        preprocessWorker_.join();
+    }
+    if (keyframeIndexer_.joinable()) {
+        keyframeIndexer_.join();
+    }
+    keyframeIndex_.clear();
+    maskCache_.close();
+
+    //an unfinished run leaves nothing behind in the shared cache
+    if (!pendingCachePath_.empty()) {
+        std::error_code error;
+        std::filesystem::remove(pendingCachePath_, error);
+        pendingCachePath_.clear();
+    }
+}
+
+std::string MillikanTracker::preprocess_settings_() const {
+    //chunked runs differ from the serial one for a while after every chunk start
+    const BackgroundModelParams & params = options_.backgroundParams;
+    std::ostringstream settings;
+    settings << "version " << PREPROCESS_VERSION << " masks " << MaskCache::VERSION
+        << " model " << background_model_name(options_.backgroundModel) << " threshold " << params.threshold
+        << " rate " << params.learningRate << " median " << params.medianInterval << " reference " << params.referenceFrames
+        << " roi " << roi_.x << ' ' << roi_.y << ' ' << roi_.width << ' ' << roi_.height << " grayscale " << options_.grayscale;
+    if (options_.chunks > 1) {
+        settings << " chunks " << options_.chunks << " warmup " << options_.warmupFrames;
+    }
+    return settings.str();
+}
+
+void MillikanTracker::cancel_preprocessing_() {
+    {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+        cancelPreprocess_ = true;
+    }
+    preprocessCv_.notify_all();
+}
+
+bool MillikanTracker::wait_for_playhead_(size_t frame) {
+    if (options_.lead != 0) {
+        std::unique_lock<std::mutex> lock(preprocessMutex_);
+        preprocessCv_.wait(lock, [&]() { return cancelPreprocess_ || unthrottled_ || (frame < playhead_ + options_.lead); });
+    }
+    return !cancelPreprocess_;
+}
+
+void MillikanTracker::store_mask_(size_t frame, const cv::Mat & fgMask) {
+    maskCache_.write(frame, fgMask);
+    //take the lock so a waiter cannot miss the notification between checking the cache and sleeping
+    {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+    }
+    preprocessCv_.notify_all();
+}
+
+void MillikanTracker::set_playhead_(size_t frame) {
+    {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+        playhead_ = frame;
+    }
+    preprocessCv_.notify_all();
+}
+
+void MillikanTracker::preprocess_pipelined_(const std::string & videoPath) {
+    cv::VideoCapture capture(videoPath);
+    if (!capture.isOpened()) {
+        throw std::runtime_error("Failed to open video: " + videoPath);
+    }
+
+    //decode -> background subtraction -> mask store, one thread per stage. frame buffers are handed
+    //down the pipeline by slot index and recycled through freeSlots, so nothing is reallocated
+    //once the pipeline has filled. the subtraction stage is a single thread so the background model sees frames in order
+    struct Slot {
+        cv::Mat frame, prepared, rawMask, fgMask;
+        size_t index;
+    };
+    static const size_t END_OF_STREAM = -1;
+
+    std::vector<Slot> slots(PIPELINE_DEPTH);
+    SpscQueue<size_t> freeSlots(PIPELINE_DEPTH), decodedSlots(PIPELINE_DEPTH + 1), processedSlots(PIPELINE_DEPTH + 1);
+    for (size_t i = 0; i < PIPELINE_DEPTH; i++) {
+        freeSlots.push(i);
+    }
+
+    pipelineStats_ = { StageStats("decode"), StageStats("subtract (" + background_model_name(options_.backgroundModel) + ")"), StageStats("store") };
+    StageStats & decodeStats = pipelineStats_[0];
+    StageStats & subtractStats = pipelineStats_[1];
+    StageStats & storeStats = pipelineStats_[2];
+
+    std::atomic<bool> & failed = cancelPreprocess_;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto fail = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        cancel_preprocessing_();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    //with a lead the decoder parks at the playhead for as long as the operator pauses, so the stages
+    //behind it sleep on their queues instead of spinning. unthrottled, they are never idle for long
+    bool throttled = (options_.lead != 0);
+    auto pop = [&](SpscQueue<size_t> & queue, size_t & slot) {
+        return throttled ? queue.wait_pop(slot, failed) : queue.pop(slot, failed);
+    };
+
+    std::thread decoder([&]() {
+        try {
+            size_t slot;
+            while (wait_for_playhead_(decodeStats.frames) && freeSlots.pop(slot, failed)) {
+                bool read;
+                {
+                    StageTimer timer(decodeStats.busySeconds);
+                    read = capture.read(slots[slot].frame);
+                }
+                if (!read) {
+                    decodedSlots.push(END_OF_STREAM, failed);
+                    break;
+                }
+                slots[slot].index = decodeStats.frames;
+                decodeStats.frames++;
+                if (!decodedSlots.push(slot, failed)) {
+                    break;
+                }
+            }
+        }
+        catch (...) {
+            fail();
+        }
+        decodeStats.wallSeconds = elapsed();
+    });
+
+    std::thread subtractor([&]() {
+        try {
+            size_t slot;
+            while (pop(decodedSlots, slot)) {
+                if (slot != END_OF_STREAM) {
+                    StageTimer timer(subtractStats.busySeconds);
+                    Slot & s = slots[slot];
+                    prepare_frame_(s.frame, s.prepared);
+                    compute_mask_(*backSub_, preprocessKernels_, s.prepared, s.rawMask, s.fgMask);
+                    subtractStats.frames++;
+                }
+                if (!processedSlots.push(slot, failed) || (slot == END_OF_STREAM)) {
+                    break;
+                }
+            }
+        }
+        catch (...) {
+            fail();
+        }
+        subtractStats.wallSeconds = elapsed();
+    });
+
+    std::thread store([&]() {
+        try {
+            size_t slot;
+            while (pop(processedSlots, slot) && (slot != END_OF_STREAM)) {
+                {
+                    StageTimer timer(storeStats.busySeconds);
+                    store_mask_(slots[slot].index, slots[slot].fgMask);
+                }
+                storeStats.frames++;
+                if (!freeSlots.push(slot, failed)) {
+                    break;
+                }
+            }
+        }
+        catch (...) {
+            fail();
+        }
+        storeStats.wallSeconds = elapsed();
+    });
+
+    decoder.join();
+    subtractor.join();
+    store.join();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool MillikanTracker::seek_exact_(cv::VideoCapture & capture, const std::string & videoPath, size_t frame) {
+    if (frame != 0) {
+        capture.set(cv::CAP_PROP_POS_FRAMES, (double)frame);
+    }
+    double position = capture.get(cv::CAP_PROP_POS_FRAMES);
+    if (position == (double)frame) {
+        return true;
+    }
+
+    //keyframe snapping lands before frame and only needs decoding forward, anything else starts over
+    size_t at = (size_t)position;
+    if (!(position >= 0.0) || (at > frame)) {
+        capture.open(videoPath);
+        if (!capture.isOpened()) {
+            return false;
+        }
+        at = 0;
+    }
+    for (; at < frame; at++) {
+        if (!capture.grab()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MillikanTracker::preprocess_chunked_(const std::string & videoPath) {
+    //background models are stateful, so each chunk gets its own subtractor warmed up on the frames just before
+    //the chunk. chunks write their masks straight into the cache index, which stitches them by frame
+    size_t chunks = std::max<size_t>(1, std::min(options_.chunks, frameCount_));
+
+    std::vector<size_t> chunkStarts;
+    for (size_t i = 0; i < chunks; i++) {
+        chunkStarts.push_back(frameCount_ * i / chunks);
+    }
+
+    size_t checkFrames = options_.boundaryCheckFrames;
+    std::vector<std::vector<cv::Mat>> chunkMasks(chunks), serialMasks(chunks);
+
+    pipelineStats_.clear();
+    for (size_t i = 0; i < chunks; i++) {
+        pipelineStats_.emplace_back("chunk " + std::to_string(i) + " (" + background_model_name(options_.backgroundModel) + ")");
+    }
+
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (size_t k = 0; k < chunks; k++) {
+        workers.emplace_back([&, k]() {
+            StageStats & stats = pipelineStats_[k];
+            try {
+                cv::VideoCapture capture(videoPath);
+                if (!capture.isOpened()) {
+                    throw std::runtime_error("Failed to open video: " + videoPath);
+                }
+
+                size_t begin = chunkStarts[k];
+                size_t end = (k + 1 < chunks) ? chunkStarts[k + 1] : std::numeric_limits<size_t>::max();
+                size_t warmStart = (begin > options_.warmupFrames) ? begin - options_.warmupFrames : 0;
+                //frames are numbered by counting from here, so the chunk must start exactly at warmStart
+                if (!seek_exact_(capture, videoPath, warmStart)) {
+                    throw std::runtime_error("Failed to decode up to frame " + std::to_string(warmStart) + " of " + videoPath);
+                }
+
+                cv::Ptr<cv::BackgroundSubtractor> subtractor = create_background_subtractor_();
+
+                MaskKernels kernels;
+                cv::Mat frame, prepared, rawMask, fgMask;
+                for (size_t i = warmStart; (i < end) && !cancelPreprocess_ && capture.read(frame); i++) {
+                    StageTimer timer(stats.busySeconds);
+                    prepare_frame_(frame, prepared);
+                    if (i < begin) {
+                        subtractor->apply(prepared, rawMask);
+                        continue;
+                    }
+
+                    compute_mask_(*subtractor, kernels, prepared, rawMask, fgMask);
+                    store_mask_(i, fgMask);
+                    if ((k != 0) && (i - begin < checkFrames)) {
+                        chunkMasks[k].push_back(fgMask.clone());
+                    }
+                    stats.frames++;
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+
+    //the checker is a plain serial pass up to the last boundary, so it is diagnostic only and does not scale
+    if ((checkFrames > 0) && (chunks > 1)) {
+        workers.emplace_back([&]() {
+            try {
+                cv::VideoCapture capture(videoPath);
+                cv::Ptr<cv::BackgroundSubtractor> subtractor = create_background_subtractor_();
+                MaskKernels kernels;
+                cv::Mat frame, prepared, rawMask, fgMask;
+                size_t last = chunkStarts.back() + checkFrames;
+                size_t k = 1;
+                for (size_t i = 0; (i < last) && !cancelPreprocess_ && capture.read(frame); i++) {
+                    prepare_frame_(frame, prepared);
+                    compute_mask_(*subtractor, kernels, prepared, rawMask, fgMask);
+                    while ((k + 1 < chunks) && (i >= chunkStarts[k] + checkFrames)) {
+                        k++;
+                    }
+                    if ((i >= chunkStarts[k]) && (i - chunkStarts[k] < checkFrames)) {
+                        serialMasks[k].push_back(fgMask.clone());
+                    }
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    for (size_t k = 1; (k < chunks) && (checkFrames > 0); k++) {
+        ChunkBoundaryReport report{ k, chunkStarts[k], 0, 0.0, 0.0 };
+        cv::Mat chunkBinary, serialBinary, difference;
+        size_t compared = std::min(chunkMasks[k].size(), serialMasks[k].size());
+        for (size_t i = 0; i < compared; i++) {
+            cv::threshold(chunkMasks[k][i], chunkBinary, 0, 255, cv::THRESH_BINARY);
+            cv::threshold(serialMasks[k][i], serialBinary, 0, 255, cv::THRESH_BINARY);
+            cv::compare(chunkBinary, serialBinary, difference, cv::CMP_NE);
+            double mismatch = (double)cv::countNonZero(difference) / difference.total();
+            report.meanMismatch += mismatch;
+            report.maxMismatch = std::max(report.maxMismatch, mismatch);
+        }
+        report.framesCompared = compared;
+        if (compared > 0) {
+            report.meanMismatch /= compared;
+        }
+        chunkReports_.push_back(report);
+    }
+}
+
+void MillikanTracker::show() {
+    if (options_.headless) {
+        return;
+    }
+
+    render(displayBuffer_);
+    cv::imshow(options_.windowName, displayBuffer_);
+}
+
+void MillikanTracker::render(cv::Mat & image) {
+    render_(flags_ & SHOW_PROCESSED, image);
+}
+
+void MillikanTracker::finish() {
+    //the text file is for analysis elsewhere, the binary one loads without parsing. existing files are
+    //rewritten even when every box was deleted, the journal is reset against them
+    if (!tracks_.empty() || std::filesystem::exists(outputPath_ + ".trk")) {
+        save_tracks_tsv(outputPath_ + ".txt", tracks_);
+        save_tracks_binary(outputPath_ + ".trk", tracks_);
+    }
+    save_keyframes_();
+
+    //the snapshot above holds every edit, but the operator should learn the session was unprotected
+    std::string journalError = journal_.get_error();
+    if (!journalError.empty()) {
+        std::cerr << journalError << std::endl;
+    }
+    journal_.reset();
+
+    if (trackerUsage_.updates > 0) {
+        std::cout << "trackers: " << trackerUsage_.updates << " updates, " << trackerUsage_.skipped
+            << " of them followed the motion model instead" << std::endl;
+    }
+}
+
+size_t MillikanTracker::open_journal() {
+    //the journal holds the edits since the last .trk snapshot, so it is replayed onto that and not onto
+    //what load_data loaded, which can be a text file edited by hand since
+    std::string snapshotPath = outputPath_ + ".trk";
+    TrackStore snapshot;
+    if (std::filesystem::exists(snapshotPath)) {
+        load_tracks_binary(snapshotPath, snapshot);
+    }
+    size_t recovered = Journal::replay(journalPath_, snapshot, keyframes_);
+    if (recovered > 0) {
+        //assigned track by track so tracks_ keeps counting revisions up
+        tracks_.resize(snapshot.track_count());
+        for (size_t i = 0; i < snapshot.track_count(); i++) {
+            tracks_.assign(i, snapshot.columns(i));
+        }
+        trackedDroplets_.clear();
+        activeDropletInd_ = NO_DROPLET;
+        adopt_tracks_();
+    }
+
+    //whatever was loaded becomes the base of the new journal. the snapshot replaces the old one by a
+    //rename, so a crash in between leaves either base with the old journal still replaying onto it
+    if (!tracks_.empty() || std::filesystem::exists(snapshotPath)) {
+        save_tracks_binary(snapshotPath, tracks_);
+    }
+    save_keyframes_();
+    journal_.open(journalPath_);
+
+    return recovered;
+}
+
+std::string MillikanTracker::get_journal_error() {
+    return journal_.get_error();
+}
+
+void MillikanTracker::prev_doplet() {
+    if ((activeDropletInd_ != 0) && (activeDropletInd_ != -1)) {
+        activeDropletInd_--;
+    }
+}
+void MillikanTracker::next_droplet() {
+    if (activeDropletInd_ < trackedDroplets_.size() - 1) {
+        activeDropletInd_++;
+    }
+}
+
+void MillikanTracker::disable_tracker() {
+    Droplet & activeDrop = trackedDroplets_[activeDropletInd_];
+
+    activeDrop.active = false;
+    erase_box_(activeDropletInd_, get_frame());
+    activeDrop.frameLastUpdated = get_frame();
+}
+void MillikanTracker::reset_tracker() {
+    if (activeDropletInd_ != NO_DROPLET) {
+        auto createTracker = trackedDroplets_[activeDropletInd_].createTracker;
+        reset_tracker_((createTracker != nullptr) ? createTracker : &create_tracker_<cv::TrackerCSRT>);
+    }
+}
+void MillikanTracker::reset_tracker_(cv::Ptr<cv::Tracker> (*createTracker)()) {
+    if ((activeDropletInd_ != NO_DROPLET) && !options_.headless) {
+        render_(true, displayBuffer_);
+        cv::Rect rect = from_preview_(cv::selectROI(options_.windowName, displayBuffer_, false, true)) & roi_;
+
+        if (!rect.empty()) {
+            auto & activeDrop = trackedDroplets_[activeDropletInd_];
+            size_t staleUntil = activeDrop.detected ? 0 : activeDrop.trackedUntil;
+            activeDrop.active = true;
+            activeDrop.detected = false;
+            activeDrop.createTracker = createTracker;
+            activeDrop.tracker = createTracker();
+            init_tracker_(activeDrop, rect - roi_.tl());
+            set_box_(activeDropletInd_, get_frame(), rect);
+            activeDrop.frameLastUpdated = get_frame();
+
+            //what the old tracker did after the corrected frame is stale, so that range is tracked again at once
+            if (staleUntil > get_frame()) {
+                retrack_to_(activeDropletInd_, staleUntil);
+            }
+        }
+    }
+}
+
+bool MillikanTracker::retrack() {
+    if (activeDropletInd_ == NO_DROPLET) {
+        return false;
+    }
+    //detected droplets are continued by association and have no tracker to rewind
+    Droplet & droplet = trackedDroplets_[activeDropletInd_];
+    if (!droplet.active || droplet.detected || !droplet.tracker) {
+        return false;
+    }
+
+    size_t shown = get_frame();
+    auto after = std::upper_bound(droplet.checkpoints.begin(), droplet.checkpoints.end(), shown,
+        [](size_t frame, const TrackerCheckpoint & checkpoint) { return frame < checkpoint.frame; });
+    if (after == droplet.checkpoints.begin()) {
+        return false;
+    }
+    TrackerCheckpoint checkpoint = *(after - 1);
+    size_t to = std::max(droplet.trackedUntil, shown);
+
+    if (!load_frame_(checkpoint.frame - 1)) {
+        load_frame_(shown - 1);
+        return false;
+    }
+    restore_checkpoint_(droplet, checkpoint);
+    retrack_to_(activeDropletInd_, to);
+    load_frame_(shown - 1);
+    return true;
+}
+
+bool MillikanTracker::start_bulk_retrack() {
+    if (bulkWorker_.joinable()) {
+        return false;
+    }
+
+    std::vector<int> keyframes(keyframes_.begin(), keyframes_.end());
+    std::sort(keyframes.begin(), keyframes.end());
+    bulkSegments_.clear();
+    for (size_t k = 0; k + 1 < keyframes.size(); k++) {
+        BulkSegment segment{ (size_t)keyframes[k], (size_t)keyframes[k + 1], {}, false };
+        //adjacent keyframes leave nothing in between to re-track
+        if (segment.last < segment.first + 2) {
+            continue;
+        }
+        for (size_t i = 0; i < trackedDroplets_.size(); i++) {
+            BulkTrack track{};
+            if (!tracks_.get(i, segment.first, track.firstKey)) {
+                continue;
+            }
+            track.firstBox = (track.firstKey & roi_) - roi_.tl();
+            if (track.firstBox.empty()) {
+                continue;
+            }
+            if (tracks_.get(i, segment.last, track.lastKey)) {
+                track.lastBox = (track.lastKey & roi_) - roi_.tl();
+            }
+            //droplets loaded from a file or found by the detector get the tracker reset_tracker would give them
+            auto createTracker = trackedDroplets_[i].createTracker;
+            track.droplet = i;
+            track.createTracker = (createTracker != nullptr) ? createTracker : &create_tracker_<cv::TrackerCSRT>;
+            segment.tracks.push_back(track);
+        }
+        if (!segment.tracks.empty()) {
+            bulkSegments_.push_back(std::move(segment));
+        }
+    }
+    if (bulkSegments_.empty()) {
+        return false;
+    }
+
+    //the workers need masks anywhere in the video, not just ahead of the playhead
+    {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+        unthrottled_ = true;
+    }
+    preprocessCv_.notify_all();
+
+    //the thread that hands out the segments works on them too, so one hardware thread is left for the
+    //operator and one for the preprocessing
+    if (!bulkPool_) {
+        unsigned int threads = std::thread::hardware_concurrency();
+        bulkPool_ = std::make_unique<ThreadPool>((threads > 3) ? threads - 3 : 1);
+    }
+    cancelBulk_ = false;
+    bulkDone_ = false;
+    bulkWorker_ = std::thread([this]() {
+        bulkPool_->parallel_for(bulkSegments_.size(), [this](size_t s) {
+            BulkSegment & segment = bulkSegments_[s];
+            try {
+                run_bulk_segment_(segment);
+            }
+            catch (const std::exception & e) {
+                segment.failed = true;
+                std::cerr << "re-tracking frames " << segment.first << " to " << segment.last << " failed: " << e.what() << std::endl;
+            }
+        });
+        bulkDone_ = true;
+    });
+    return true;
+}
+bool MillikanTracker::bulk_retrack_running() {
+    return bulkWorker_.joinable() && !bulkDone_;
+}
+bool MillikanTracker::merge_bulk_retrack() {
+    if (!bulkWorker_.joinable() || !bulkDone_) {
+        return false;
+    }
+    bulkWorker_.join();
+    {
+        std::lock_guard<std::mutex> lock(preprocessMutex_);
+        unthrottled_ = false;
+    }
+
+    //the whole run lands between two frames the operator sees, never part of it
+    segmentReports_.clear();
+    for (const BulkSegment & segment : bulkSegments_) {
+        for (const BulkTrack & track : segment.tracks) {
+            merge_bulk_track_(segment, track);
+        }
+    }
+    bulkSegments_.clear();
+    return true;
+}
+const std::vector<SegmentReport> & MillikanTracker::get_segment_reports() {
+    return segmentReports_;
+}
+
+const DriftAnalysis & MillikanTracker::analyse(const Calibration & calibration, const DriftAnalysis::Params & params) {
+    analysis_.set_params(params);
+    analysis_.set_scale(calibration, fps_);
+    analysis_.set_keyframes(std::vector<size_t>(keyframes_.begin(), keyframes_.end()));
+    analysis_.update(tracks_);
+    return analysis_;
+}
+
+bool MillikanTracker::next_frame() {
+    return step_to_(frame_);
+}
+bool MillikanTracker::prev_frame() {
+    if (frame_ >= 2) {
+        return step_to_(frame_ - 2);
+    }
+
+    return false;
+}
+void MillikanTracker::beginning() {
+    step_to_(0);
+}
+bool MillikanTracker::go_to_frame(size_t frame) {
+    return (frame >= 1) && step_to_(frame - 1);
+}
+
+void MillikanTracker::load_data(const std::string & dataFilepath) {
+    load_tracks(dataFilepath, tracks_);
+    trackedDroplets_.clear();
+    adopt_tracks_();
+}
+
+void MillikanTracker::load_keyframes(const std::string & keyframeFilepath) {
+    std::ifstream keyframeFile(keyframeFilepath);
+    std::string line;
+    getline(keyframeFile, line);
+    while (getline(keyframeFile, line)) {
+        keyframes_.insert(std::stol(line));
+    }
+    keyframeFile.close();
+}
+void MillikanTracker::mark_keyframe() {
+    if (keyframes_.insert(get_frame()).second) {
+        journal_.mark_keyframe(get_frame());
+    }
+}
+void MillikanTracker::unmark_keyframe() {
+    if (keyframes_.erase(get_frame()) != 0) {
+        journal_.unmark_keyframe(get_frame());
+    }
+}
+bool MillikanTracker::is_keyframe() {
+    return keyframes_.contains(get_frame());
+}
+
+bool MillikanTracker::get_flag(unsigned char flag) {
+    return flags_ & flag;
+}
+void MillikanTracker::set_flag(unsigned char flag, bool value) {
+    if (value) {
+        flags_ |= flag;
+    }
+    else {
+        flags_ &= ~flag;
+    }
+}
+
+size_t MillikanTracker::get_frame() {
+    return frame_;
+}
+double MillikanTracker::get_fps() {
+    return fps_;
+}
+
+const std::vector<StageStats> & MillikanTracker::get_pipeline_stats() {
+    return pipelineStats_;
+}
+const std::vector<ChunkBoundaryReport> & MillikanTracker::get_chunk_reports() {
+    return chunkReports_;
+}
+const TrackerUsage & MillikanTracker::get_tracker_usage() {
+    return trackerUsage_;
+}
+const FrameCache & MillikanTracker::get_frame_cache() {
+    return frameCache_;
+}
+bool MillikanTracker::preprocessing_done() {
+    std::lock_guard<std::mutex> lock(preprocessMutex_);
+    return preprocessDone_;
+}
+
+MillikanTracker::~MillikanTracker() {
+    if (video_.isOpened()) {
+        video_.release();
+    }
+    stop_preprocessing_();
+    //without finish the journal is left behind for open_journal to recover
+    journal_.close();
+
+    if (!options_.headless) {
+        cv::destroyWindow(options_.windowName);
+    }
+}
+
+void MillikanTracker::update_trackers_() {
+    resume_stale_trackers_();
+
+    pendingUpdates_.clear();
+    trackerResults_.clear();
+    for (size_t i = 0; i < trackedDroplets_.size(); i++) {
+        auto & activeDrop = trackedDroplets_[i];
+
+        if (activeDrop.frameLastUpdated < get_frame()) {
+            if (activeDrop.active && activeDrop.detected) {
+                //continued by detect_droplets_
+                continue;
+            }
+            else if (activeDrop.active) {
+                pendingUpdates_.push_back(i);
+                trackerResults_.push_back({ get_frame() - activeDrop.frameLastUpdated, false, false, cv::Rect() });
+            }
+            else {
+                erase_box_(i, get_frame());
+            }
+            activeDrop.frameLastUpdated = get_frame();
+        }
+    }
+
+    //the pyramid is built here, once for all droplets, and only on frames that have trackers to update
+    const cv::Mat & trackingFrame = pendingUpdates_.empty() ? processedFrame_ : tracking_frame_();
+
+    //trackers are independent, so they update concurrently into their own result slot and are
+    //written back in droplet order afterwards, giving the same result as updating them one by one.
+    //they run on the roi_ crop, so their boxes are shifted back to full frame coordinates on write back
+    auto update = [this, &trackingFrame](size_t j) {
+        track_droplet_(trackedDroplets_[pendingUpdates_[j]], trackingFrame, trackerResults_[j]);
+    };
+    if (trackerPool_ && (pendingUpdates_.size() > 1)) {
+        trackerPool_->parallel_for(pendingUpdates_.size(), update);
+    }
+    else {
+        for (size_t j = 0; j < pendingUpdates_.size(); j++) {
+            update(j);
+        }
+    }
+
+    for (size_t j = 0; j < pendingUpdates_.size(); j++) {
+        store_result_(pendingUpdates_[j], trackerResults_[j]);
+    }
+
+    if (get_flag(AUTO_DETECT)) {
+        detect_droplets_();
+    }
+}
+
+void MillikanTracker::track_droplet_(Droplet & droplet, const cv::Mat & trackingFrame, TrackerResult & result) const {
+    result.skipped = follow_motion_(droplet, result.elapsed, result.bbox);
+    if (result.skipped) {
+        result.found = true;
+        return;
+    }
+
+    result.found = droplet.tracker->update(trackingFrame, result.bbox);
+    if (result.found) {
+        result.bbox = from_tracking_(fgMask_, droplet.boxSize, droplet.refineOffset, result.bbox);
+        observe_tracker_(droplet, result.bbox);
+    }
+    else {
+        droplet.lockedFrames = 0;
+    }
+}
+
+void MillikanTracker::store_result_(size_t index, const TrackerResult & result) {
+    trackerUsage_.updates++;
+    trackerUsage_.skipped += result.skipped;
+    if (!result.found) {
+        return;
+    }
+
+    Droplet & droplet = trackedDroplets_[index];
+    set_box_(index, get_frame(), result.bbox + roi_.tl());
+    droplet.trackedUntil = std::max(droplet.trackedUntil, get_frame());
+    if (droplet.checkpoints.empty() || (get_frame() >= droplet.checkpoints.back().frame + CHECKPOINT_INTERVAL)) {
+        checkpoint_(droplet, result.bbox);
+    }
+}
+
+void MillikanTracker::checkpoint_(Droplet & droplet, const cv::Rect & box) {
+    size_t frame = get_frame();
+    while (!droplet.checkpoints.empty() && (droplet.checkpoints.back().frame >= frame)) {
+        droplet.checkpoints.pop_back();
+    }
+
+    //only trackers without outside resources can be copied, the others are started on the box again
+    cv::Ptr<cv::Tracker> copy;
+    if (auto centroidTracker = dynamic_cast<const CentroidTracker *>(droplet.tracker.get())) {
+        copy = cv::makePtr<CentroidTracker>(*centroidTracker);
+    }
+    droplet.checkpoints.push_back({ frame, box, copy, droplet.motion, droplet.lockedFrames, droplet.trackerBox, droplet.trackerArea, droplet.centroidOffset });
+}
+
+void MillikanTracker::restore_checkpoint_(Droplet & droplet, const TrackerCheckpoint & checkpoint) {
+    if (auto centroidTracker = dynamic_cast<const CentroidTracker *>(checkpoint.tracker.get())) {
+        //copied again, the checkpoint stays usable for the next rewind
+        droplet.tracker = cv::makePtr<CentroidTracker>(*centroidTracker);
+    }
+    else {
+        droplet.tracker = droplet.createTracker();
+        droplet.tracker->init(tracking_frame_(), to_tracking_(checkpoint.box));
+    }
+    droplet.motion = checkpoint.motion;
+    droplet.lockedFrames = checkpoint.lockedFrames;
+    droplet.trackerBox = checkpoint.trackerBox;
+    droplet.trackerArea = checkpoint.trackerArea;
+    droplet.centroidOffset = checkpoint.centroidOffset;
+    droplet.trackerStale = false;
+
+    while (!droplet.checkpoints.empty() && (droplet.checkpoints.back().frame > checkpoint.frame)) {
+        droplet.checkpoints.pop_back();
+    }
+}
+
+void MillikanTracker::retrack_to_(size_t index, size_t to) {
+    Droplet & droplet = trackedDroplets_[index];
+    size_t start = get_frame();
+
+    //only the stale range is visited and only this droplet is updated, the others keep their boxes
+    droplet.frameLastUpdated = start;
+    for (size_t frame = start + 1; (frame <= to) && load_frame_(frame - 1); frame++) {
+        TrackerResult result{ 1, false, false, cv::Rect() };
+        track_droplet_(droplet, tracking_frame_(), result);
+        store_result_(index, result);
+        if (!result.found) {
+            erase_box_(index, frame);
+        }
+        droplet.frameLastUpdated = frame;
+    }
+    droplet.trackedUntil = droplet.frameLastUpdated;
+
+    load_frame_(start - 1);
+}
+
+void MillikanTracker::resume_stale_trackers_() {
+    size_t shown = get_frame();
+    bool moved = false;
+    for (Droplet & droplet : trackedDroplets_) {
+        if (!droplet.trackerStale || (droplet.frameLastUpdated >= shown)) {
+            continue;
+        }
+        droplet.trackerStale = false;
+        if (!droplet.active || droplet.detected || droplet.checkpoints.empty()) {
+            continue;
+        }
+        //the merge left a checkpoint where its boxes end, which is frameLastUpdated
+        TrackerCheckpoint checkpoint = droplet.checkpoints.back();
+        if (load_frame_(checkpoint.frame - 1)) {
+            restore_checkpoint_(droplet, checkpoint);
+            moved = true;
+        }
+    }
+    if (moved) {
+        load_frame_(shown - 1);
+    }
+}
+
+void MillikanTracker::run_bulk_segment_(BulkSegment & segment) {
+    cv::VideoCapture capture(videoPath_);
+    if (!capture.isOpened()) {
+        throw std::runtime_error("Failed to open video: " + videoPath_);
+    }
+
+    size_t length = segment.last - segment.first + 1;
+    for (BulkTrack & track : segment.tracks) {
+        track.forward.assign(length, cv::Rect());
+        track.backward.assign(length, cv::Rect());
+    }
+
+    //every droplet of the segment is tracked on each decoded frame, so the segment is decoded once per pass
+    //the boxes are merged by frame number, so both passes only start where the decoder is known to be
+    BulkFrame frame;
+    if (!seek_exact_(capture, videoPath_, segment.first - 1)) {
+        throw std::runtime_error("Failed to decode up to frame " + std::to_string(segment.first) + " of " + videoPath_);
+    }
+    for (size_t i = 0; (i < length) && !cancelBulk_; i++) {
+        if (!read_bulk_frame_(capture, segment.first - 1 + i, frame)) {
+            break;
+        }
+        for (BulkTrack & track : segment.tracks) {
+            if (i == 0) {
+                track.forward[0] = track.firstBox;
+                track.forwardOffset = refine_offset_(frame.fgMask, track.firstBox);
+                track.tracker = track.createTracker();
+                track.tracker->init(frame.tracking, to_tracking_(track.firstBox));
+                continue;
+            }
+            cv::Rect box;
+            if (track.tracker->update(frame.tracking, box)) {
+                track.forward[i] = from_tracking_(frame.fgMask, track.firstBox.size(), track.forwardOffset, box);
+            }
+        }
+    }
+
+    //a droplet without a closing box is tracked back from where the forward pass last saw it, so its
+    //boxes are checked like the others and drift or a swap to another droplet fails to lead back
+    size_t end = 0;
+    for (BulkTrack & track : segment.tracks) {
+        track.backwardStart = 0;
+        if (!track.lastBox.empty()) {
+            track.backwardStart = length - 1;
+        }
+        else {
+            for (size_t i = length - 1; (i > 0) && (track.backwardStart == 0); i--) {
+                track.backwardStart = track.forward[i].empty() ? 0 : i;
+            }
+        }
+        if (track.backwardStart > 0) {
+            end = std::max(end, track.backwardStart + 1);
+        }
+    }
+
+    //video decodes forward only, so the backward pass decodes a block at a time and walks it in reverse
+    std::vector<BulkFrame> block(std::min(BACKWARD_BLOCK, std::max<size_t>(end, 1)));
+    while ((end > 0) && !cancelBulk_) {
+        size_t begin = (end > block.size()) ? end - block.size() : 0;
+        if (!seek_exact_(capture, videoPath_, segment.first - 1 + begin)) {
+            return;
+        }
+        size_t count = 0;
+        while ((begin + count < end) && read_bulk_frame_(capture, segment.first - 1 + begin + count, block[count])) {
+            count++;
+        }
+        //frames the pass cannot reach stay empty, which fails the consistency check
+        if (count < end - begin) {
+            return;
+        }
+
+        for (size_t k = count; (k-- > 0) && !cancelBulk_;) {
+            size_t i = begin + k;
+            const BulkFrame & current = block[k];
+            for (BulkTrack & track : segment.tracks) {
+                if (i > track.backwardStart) {
+                    continue;
+                }
+                const cv::Rect & start = track.lastBox.empty() ? track.forward[track.backwardStart] : track.lastBox;
+                if (i == track.backwardStart) {
+                    if (i == 0) {
+                        continue;
+                    }
+                    track.backward[i] = start;
+                    track.backwardOffset = refine_offset_(current.fgMask, start);
+                    track.tracker = track.createTracker();
+                    track.tracker->init(current.tracking, to_tracking_(start));
+                    continue;
+                }
+                cv::Rect box;
+                if (track.tracker->update(current.tracking, box)) {
+                    track.backward[i] = from_tracking_(current.fgMask, start.size(), track.backwardOffset, box);
+                }
+            }
+        }
+        end = begin;
+    }
+    for (BulkTrack & track : segment.tracks) {
+        track.tracker.reset();
+    }
+}
+
+bool MillikanTracker::read_bulk_frame_(cv::VideoCapture & capture, size_t index, BulkFrame & frame) {
+    if (!capture.read(frame.source)) {
+        return false;
+    }
+    load_mask_(index, frame.fgMask);
+    prepare_frame_(frame.source, frame.prepared);
+    MaskKernels::masked_copy(frame.prepared, frame.fgMask, frame.processed);
+    if (trackingLevels_ == 0) {
+        frame.tracking = frame.processed;
+    }
+    else {
+        build_pyramid_(frame.processed, frame.pyramid);
+        frame.tracking = frame.pyramid.back();
+    }
+    return true;
+}
+
+void MillikanTracker::merge_bulk_track_(const BulkSegment & segment, const BulkTrack & track) {
+    auto center = [](const cv::Rect & box) {
+        return cv::Point2f(box.x + box.width / 2.0f, box.y + box.height / 2.0f);
+    };
+
+    size_t length = segment.last - segment.first + 1;
+    bool closed = !track.lastBox.empty();
+    SegmentReport report{ track.droplet, segment.first, segment.last, 0.0f, false };
+    //a droplet the forward pass lost straight away has nothing to check its boxes with
+    bool complete = !segment.failed && !cancelBulk_ && (track.forward.size() == length) && (track.backwardStart > 0);
+    if (!complete) {
+        report.maxDisagreement = std::numeric_limits<float>::infinity();
+    }
+    //the open pass starts from its own last box, so it is checked from the opening keyframe box on
+    for (size_t i = closed ? 1 : 0; complete && (i < track.backwardStart); i++) {
+        if (track.forward[i].empty() || track.backward[i].empty()) {
+            report.maxDisagreement = std::numeric_limits<float>::infinity();
+            break;
+        }
+        cv::Point2f difference = center(track.forward[i]) - center(track.backward[i]);
+        report.maxDisagreement = std::max(report.maxDisagreement, std::sqrt(difference.x * difference.x + difference.y * difference.y));
+    }
+
+    //boxes the operator drew since the start make the run stale, the segment is re-tracked by the next one
+    cv::Rect box;
+    bool firstKept = keyframes_.contains((int)segment.first)
+        && tracks_.get(track.droplet, segment.first, box) && (box == track.firstKey);
+    bool lastKept = keyframes_.contains((int)segment.last)
+        && (closed ? (tracks_.get(track.droplet, segment.last, box) && (box == track.lastKey)) : !tracks_.contains(track.droplet, segment.last));
+    float gate = options_.retrackGate * std::min(track.firstBox.width, track.firstBox.height);
+    if (!complete || !firstKept || !lastKept || !(report.maxDisagreement <= gate)) {
+        segmentReports_.push_back(report);
+        return;
+    }
+
+    for (size_t i = 1; i + 1 < length; i++) {
+        size_t frame = segment.first + i;
+        if (!closed) {
+            if (track.forward[i].empty()) {
+                erase_box_(track.droplet, frame);
+            }
+            else {
+                set_box_(track.droplet, frame, track.forward[i] + roi_.tl());
+            }
+            continue;
+        }
+        //each pass is trusted more the closer the frame is to the keyframe it started from
+        const cv::Rect & forward = track.forward[i];
+        const cv::Rect & backward = track.backward[i];
+        float weight = (float)i / (float)(length - 1);
+        cv::Point2f middle = center(forward) * (1.0f - weight) + center(backward) * weight;
+        float width = forward.width * (1.0f - weight) + backward.width * weight;
+        float height = forward.height * (1.0f - weight) + backward.height * weight;
+        cv::Rect blended(cvRound(middle.x - width / 2.0f), cvRound(middle.y - height / 2.0f), cvRound(width), cvRound(height));
+        set_box_(track.droplet, frame, blended + roi_.tl());
+    }
+    report.merged = true;
+    segmentReports_.push_back(report);
+
+    //checkpoints inside the segment describe the replaced boxes. the droplet is checkpointed at both ends
+    //instead, the closing one being where its tracker resumes if the merge reached past it
+    Droplet & droplet = trackedDroplets_[track.droplet];
+    size_t mergedUntil = closed ? segment.last : segment.last - 1;
+    cv::Rect endBox = closed ? track.lastBox : track.forward[length - 2];
+    std::erase_if(droplet.checkpoints, [&](const TrackerCheckpoint & checkpoint) {
+        return (checkpoint.frame >= segment.first) && (checkpoint.frame <= segment.last);
+    });
+    auto add_checkpoint = [&droplet](size_t frame, const cv::Rect & box) {
+        auto at = std::lower_bound(droplet.checkpoints.begin(), droplet.checkpoints.end(), frame,
+            [](const TrackerCheckpoint & checkpoint, size_t frame) { return checkpoint.frame < frame; });
+        droplet.checkpoints.insert(at, { frame, box, nullptr, MotionFilter(), 0, box, 0.0f, cv::Point2f(0.0f, 0.0f) });
+    };
+    add_checkpoint(segment.first, track.firstBox);
+    if (!endBox.empty()) {
+        add_checkpoint(mergedUntil, endBox);
+    }
+
+    //stepping over merged frames must neither erase nor re-track them
+    if ((droplet.frameLastUpdated != std::numeric_limits<size_t>::max()) && (droplet.frameLastUpdated < mergedUntil)) {
+        droplet.frameLastUpdated = mergedUntil;
+        droplet.trackerStale = droplet.active && !droplet.detected && !endBox.empty();
+    }
+    if (!droplet.detected) {
+        droplet.trackedUntil = std::max(droplet.trackedUntil, mergedUntil);
+    }
+}
+
+void MillikanTracker::stop_bulk_retrack_() {
+    cancelBulk_ = true;
+    if (bulkWorker_.joinable()) {
+        bulkWorker_.join();
+    }
+    bulkSegments_.clear();
+    bulkDone_ = true;
+}
+
+const cv::Mat & MillikanTracker::tracking_frame_() {
+    if (trackingLevels_ == 0) {
+        return processedFrame_;
+    }
+    if (!pyramidValid_) {
+        build_pyramid_(processedFrame_, pyramid_);
+        pyramidValid_ = true;
+    }
+    return pyramid_.back();
+}
+
+void MillikanTracker::build_pyramid_(const cv::Mat & processed, std::vector<cv::Mat> & pyramid) const {
+    //each level reuses its buffer from the previous frame
+    pyramid.resize(trackingLevels_);
+    const cv::Mat * level = &processed;
+    for (cv::Mat & next : pyramid) {
+        cv::pyrDown(*level, next);
+        level = &next;
+    }
+}
+
+cv::Rect MillikanTracker::to_tracking_(const cv::Rect & box) const {
+    if (trackingLevels_ == 0) {
+        return box;
+    }
+    int scale = 1 << trackingLevels_;
+    cv::Point tl(box.x / scale, box.y / scale);
+    cv::Point br((box.x + box.width + scale - 1) / scale, (box.y + box.height + scale - 1) / scale);
+    return cv::Rect(tl, br);
+}
+
+cv::Rect MillikanTracker::from_tracking_(const cv::Mat & fgMask, cv::Size boxSize, cv::Point2f refineOffset, const cv::Rect & box) const {
+    if (trackingLevels_ == 0) {
+        return box;
+    }
+
+    //the coarse box is only accurate to a coarse pixel, so the centroid is searched a coarse pixel around it
+    int scale = 1 << trackingLevels_;
+    cv::Rect coarse(box.x * scale, box.y * scale, box.width * scale, box.height * scale);
+    cv::Point2f center(coarse.x + coarse.width / 2.0f, coarse.y + coarse.height / 2.0f);
+    cv::Rect window = cv::Rect(coarse.x - scale, coarse.y - scale, coarse.width + 2 * scale, coarse.height + 2 * scale)
+        & cv::Rect(0, 0, fgMask.cols, fgMask.rows);
+    if (!window.empty()) {
+        cv::Moments moments = cv::moments(fgMask(window), true);
+        if (moments.m00 > 0.0) {
+            center = cv::Point2f(window.x + moments.m10 / moments.m00, window.y + moments.m01 / moments.m00) + refineOffset;
+        }
+    }
+    return cv::Rect(cvRound(center.x - boxSize.width / 2.0f), cvRound(center.y - boxSize.height / 2.0f),
+        boxSize.width, boxSize.height);
+}
+
+cv::Point2f MillikanTracker::refine_offset_(const cv::Mat & fgMask, const cv::Rect & box) {
+    cv::Rect window = box & cv::Rect(0, 0, fgMask.cols, fgMask.rows);
+    if (window.empty()) {
+        return cv::Point2f(0.0f, 0.0f);
+    }
+    cv::Moments moments = cv::moments(fgMask(window), true);
+    if (moments.m00 <= 0.0) {
+        return cv::Point2f(0.0f, 0.0f);
+    }
+    return cv::Point2f(box.x + box.width / 2.0f, box.y + box.height / 2.0f)
+        - cv::Point2f(window.x + moments.m10 / moments.m00, window.y + moments.m01 / moments.m00);
+}
+
+void MillikanTracker::init_tracker_(Droplet & droplet, const cv::Rect & box) {
+    droplet.tracker->init(tracking_frame_(), to_tracking_(box));
+    droplet.reset_motion();
+    droplet.trackedUntil = get_frame();
+    droplet.trackerStale = false;
+    checkpoint_(droplet, box);
+
+    droplet.boxSize = box.size();
+    droplet.refineOffset = refine_offset_(fgMask_, box);
+}
+
+bool MillikanTracker::follow_motion_(Droplet & droplet, size_t elapsed, cv::Rect & box) const {
+    const MotionFilter::Params & params = options_.motion;
+    if (!droplet.motion.initialized()) {
+        return false;
+    }
+    droplet.motion.predict((float)elapsed);
+    if (!params.skipTracker || (elapsed != 1) || (droplet.lockedFrames < params.lockFrames)) {
+        return false;
+    }
+
+    //the tracker resumes from where it last was, so it may only fall so far behind
+    cv::Point2f predicted = droplet.motion.position();
+    cv::Size size = droplet.trackerBox.size();
+    cv::Point2f trackerCenter(droplet.trackerBox.x + size.width / 2.0f, droplet.trackerBox.y + size.height / 2.0f);
+    cv::Point2f drift = predicted - trackerCenter;
+    if (std::sqrt(drift.x * drift.x + drift.y * drift.y) > params.maxDrift * std::min(size.width, size.height)) {
+        return false;
+    }
+
+    //only a window around the prediction is searched
+    cv::Point2f expected = predicted - droplet.centroidOffset;
+    float width = size.width * params.searchScale;
+    float height = size.height * params.searchScale;
+    cv::Rect search = cv::Rect(cvRound(expected.x - width / 2.0f), cvRound(expected.y - height / 2.0f), cvRound(width), cvRound(height))
+        & cv::Rect(0, 0, fgMask_.cols, fgMask_.rows);
+    if (search.empty()) {
+        return false;
+    }
+    cv::Moments moments = cv::moments(fgMask_(search), true);
+    if ((moments.m00 < 1.0) || (moments.m00 < params.minAreaRatio * droplet.trackerArea) || (moments.m00 > params.maxAreaRatio * droplet.trackerArea)) {
+        return false;
+    }
+
+    cv::Point2f measured = cv::Point2f(search.x + moments.m10 / moments.m00, search.y + moments.m01 / moments.m00) + droplet.centroidOffset;
+    if (droplet.motion.innovation(measured) > params.skipGate) {
+        return false;
+    }
+
+    droplet.motion.correct(measured);
+    box = cv::Rect(cvRound(measured.x - size.width / 2.0f), cvRound(measured.y - size.height / 2.0f), size.width, size.height);
+    return true;
+}
+
+void MillikanTracker::observe_tracker_(Droplet & droplet, const cv::Rect & box) const {
+    const MotionFilter::Params & params = options_.motion;
+    cv::Point2f center(box.x + box.width / 2.0f, box.y + box.height / 2.0f);
+
+    cv::Rect window = box & cv::Rect(0, 0, fgMask_.cols, fgMask_.rows);
+    cv::Moments moments = window.empty() ? cv::Moments() : cv::moments(fgMask_(window), true);
+    droplet.trackerBox = box;
+    droplet.trackerArea = (float)moments.m00;
+    droplet.centroidOffset = (moments.m00 > 0.0)
+        ? center - cv::Point2f(window.x + moments.m10 / moments.m00, window.y + moments.m01 / moments.m00)
+        : cv::Point2f(0.0f, 0.0f);
+
+    //a new filter, or the droplet did something a constant velocity does not explain, e.g. the field reversed
+    if (!droplet.motion.initialized() || (droplet.motion.innovation(center) > params.resetGate)) {
+        droplet.motion.init(center, params);
+        droplet.lockedFrames = 0;
+        return;
+    }
+    droplet.motion.correct(center);
+    droplet.lockedFrames++;
+}
+
+void MillikanTracker::detect_droplets_() {
+    //only frames the detector has not seen before may seed tracks, so stepping back and forth cannot duplicate them
+    size_t frame = get_frame();
+    if (frame <= detectorFrameLast_) {
+        return;
+    }
+    detectorFrameLast_ = frame;
+
+    //detections are in roi_ coordinates, droplet centres and boxes in full frame coordinates
+    const std::vector<Detection> & detections = detector_.detect(fgMask_);
+    cv::Point2f offset(roi_.tl());
+
+    //droplets that are not continued by association keep the detections inside their box to themselves
+    detectedTracks_.clear();
+    detectedPredictions_.clear();
+    for (size_t i = 0; i < trackedDroplets_.size(); i++) {
+        Droplet & droplet = trackedDroplets_[i];
+        if (droplet.active && droplet.detected && (droplet.frameLastUpdated < frame)) {
+            detectedTracks_.push_back(i);
+            detectedPredictions_.push_back(droplet.center + droplet.velocity * (float)(frame - droplet.frameLastUpdated) - offset);
+            continue;
+        }
+
+        cv::Rect box;
+        if (tracks_.get(i, frame, box)) {
+            for (size_t d = 0; d < detections.size(); d++) {
+                if (box.contains(cv::Point(detections[d].centroid + offset))) {
+                    detector_.claim(d);
+                }
+            }
+        }
+    }
+
+    detector_.associate(detectedPredictions_, detectedAssignment_);
+
+    for (size_t j = 0; j < detectedTracks_.size(); j++) {
+        Droplet & droplet = trackedDroplets_[detectedTracks_[j]];
+        size_t d = detectedAssignment_[j];
+        if (d != DropletDetector::NO_MATCH) {
+            cv::Point2f center = detections[d].centroid + offset;
+            droplet.velocity = (center - droplet.center) * (1.0f / (frame - droplet.frameLastUpdated));
+            droplet.center = center;
+            droplet.missedFrames = 0;
+            set_box_(detectedTracks_[j], frame, cv::Rect(cvRound(center.x - droplet.size.width / 2.0), cvRound(center.y - droplet.size.height / 2.0), droplet.size.width, droplet.size.height));
+        }
+        else if (++droplet.missedFrames > detector_.get_params().maxMissed) {
+            droplet.active = false;
+        }
+        droplet.frameLastUpdated = frame;
+    }
+
+    int padding = detector_.get_params().padding;
+    for (size_t d = 0; d < detections.size(); d++) {
+        if (detector_.is_matched(d)) {
+            continue;
+        }
+
+        cv::Rect box(roi_.x + detections[d].box.x - padding, roi_.y + detections[d].box.y - padding, detections[d].box.width + 2 * padding, detections[d].box.height + 2 * padding);
+        trackedDroplets_.emplace_back();
+        size_t track = tracks_.add_track();
+        Droplet & droplet = trackedDroplets_.back();
+        droplet.active = true;
+        droplet.detected = true;
+        droplet.center = detections[d].centroid + offset;
+        droplet.velocity = cv::Point2f(0, 0);
+        droplet.size = box.size();
+        droplet.frameLastUpdated = frame;
+        set_box_(track, frame, box);
+    }
+
+    if ((activeDropletInd_ == NO_DROPLET) && !trackedDroplets_.empty()) {
+        activeDropletInd_ = 0;
+    }
+}
+
+void MillikanTracker::draw_overlay_() {
+    overlay_.text("frame: " + std::to_string(get_frame()), cv::Point(10, 20), 0.5, cv::Scalar(255, 0, 255));
+    overlay_.text("active droplet: " + ((activeDropletInd_ == -1) ? "NONE" : std::to_string(activeDropletInd_)), cv::Point(10, 40), 0.5, cv::Scalar(255, 0, 255));
+    if (keyframes_.contains(get_frame())) {
+        overlay_.text("KEYFRAME", cv::Point(10, 60), 0.5, cv::Scalar(0, 255, 255));
+    }
+    if (roi_.size() != currentFrame_.size()) {
+        overlay_.rectangle(to_preview_(roi_), cv::Scalar(0, 255, 0));
+    }
+
+    cv::Rect box;
+    for (size_t i = 0; i < tracks_.track_count(); i++) {
+        if (tracks_.get(i, get_frame(), box)) {
+            box = to_preview_(box);
+            overlay_.text(std::to_string(i), cv::Point(box.x - 7, box.y + 2), 0.25, cv::Scalar(255, 0, 255));
+            if (i != activeDropletInd_) {
+                overlay_.rectangle(box, cv::Scalar(255, 0, 0));
+            }
+            else {
+                overlay_.rectangle(box, cv::Scalar(0, 0, 255));
+            }
+        }
+    }
+}
+
+void MillikanTracker::set_box_(size_t track, size_t frame, const cv::Rect & box) {
+    tracks_.set(track, frame, box);
+    journal_.set_box(track, frame, box);
+}
+void MillikanTracker::erase_box_(size_t track, size_t frame) {
+    //inactive droplets are erased every frame, only actual removals are worth journaling
+    if (tracks_.erase(track, frame)) {
+        journal_.erase_box(track, frame);
+    }
+}
+
+void MillikanTracker::adopt_tracks_() {
+    //droplets that came from a file are shown but not tracked until their tracker is reset
+    size_t first = trackedDroplets_.size();
+    trackedDroplets_.resize(tracks_.track_count());
+    for (size_t i = first; i < trackedDroplets_.size(); i++) {
+        trackedDroplets_[i].active = false;
+        trackedDroplets_[i].frameLastUpdated = std::numeric_limits<size_t>::max();
+    }
+    if ((activeDropletInd_ == NO_DROPLET) && !trackedDroplets_.empty()) {
+        activeDropletInd_ = 0;
+    }
+}
+
+void MillikanTracker::save_keyframes_() {
+    //an existing file is rewritten even when empty, so unmarking the last keyframe sticks
+    std::string path = outputPath_ + ".kfr";
+    if (keyframes_.empty() && !std::filesystem::exists(path)) {
+        return;
+    }
+
+    std::ofstream keyframeFile(path);
+    keyframeFile << "keyframe\n";
+    for (int keyframe : keyframes_) {
+        keyframeFile << keyframe << '\n';
+    }
+    keyframeFile.close();
+}
+
+void MillikanTracker::compact_journal_() {
+    //the binary snapshot takes milliseconds even for long sessions, and keeps replay on the next open short.
+    //it throws before the journal is reset if the snapshot could not be written
+    save_tracks_binary(outputPath_ + ".trk", tracks_);
+    save_keyframes_();
+    journal_.reset();
+}
+
+void MillikanTracker::render_(bool processed, cv::Mat & image) {
+    const cv::Mat * source = &currentFrame_;
+    if (processed && (roi_.size() == currentFrame_.size()) && (processedFrame_.type() == currentFrame_.type())) {
+        source = &processedFrame_;
+    }
+    else if (processed) {
+        //only the band is rewritten, the black around it is cleared when the buffer is allocated
+        if ((bandBuffer_.size() != currentFrame_.size()) || (bandBuffer_.type() != currentFrame_.type())) {
+            bandBuffer_.create(currentFrame_.size(), currentFrame_.type());
+            bandBuffer_.setTo(cv::Scalar::all(0));
+        }
+        cv::Mat region = bandBuffer_(roi_);
+        if (processedFrame_.channels() != region.channels()) {
+            cv::cvtColor(processedFrame_, region, cv::COLOR_GRAY2BGR);
+        }
+        else {
+            processedFrame_.copyTo(region);
+        }
+        source = &bandBuffer_;
+    }
+
+    //one pass from the cached frame into the caller's persistent buffer, scaling on the way for previews
+    cv::Size size = preview_size_();
+    if (size == source->size()) {
+        source->copyTo(image);
+    }
+    else {
+        cv::resize(*source, image, size, 0, 0, cv::INTER_AREA);
+    }
+
+    OverlayKey key{ get_frame(), activeDropletInd_, is_keyframe(), tracks_.revision(), size };
+    if (!(key == overlayKey_)) {
+        overlay_.begin(size);
+        draw_overlay_();
+        overlayKey_ = key;
+    }
+    overlay_.compose(image);
+}
+
+cv::Size MillikanTracker::preview_size_() const {
+    double scale = preview_scale_();
+    return cv::Size(std::max(1, cvRound(currentFrame_.cols * scale)), std::max(1, cvRound(currentFrame_.rows * scale)));
+}
+
+double MillikanTracker::preview_scale_() const {
+    return ((options_.previewScale > 0.0) && (options_.previewScale < 1.0)) ? options_.previewScale : 1.0;
+}
+
+cv::Rect MillikanTracker::to_preview_(const cv::Rect & rect) const {
+    double scale = preview_scale_();
+    return cv::Rect(cvRound(rect.x * scale), cvRound(rect.y * scale), std::max(1, cvRound(rect.width * scale)), std::max(1, cvRound(rect.height * scale)));
+}
+
+cv::Rect MillikanTracker::from_preview_(const cv::Rect & rect) const {
+    double scale = preview_scale_();
+    return cv::Rect(cvRound(rect.x / scale), cvRound(rect.y / scale), cvRound(rect.width / scale), cvRound(rect.height / scale));
+}
+
+void MillikanTracker::prepare_frame_(const cv::Mat & frame, cv::Mat & prepared) const {
+    //the crop is a view, so only the grayscale conversion touches pixels, and only those inside roi_
+    cv::Mat region = (roi_.size() == frame.size()) ? frame : frame(roi_);
+    if (options_.grayscale && (region.channels() == 3)) {
+        cv::cvtColor(region, prepared, cv::COLOR_BGR2GRAY);
+    }
+    else {
+        prepared = region;
+    }
+}
+
+bool MillikanTracker::step_to_(size_t index) {
+    if (!load_frame_(index)) {
+        return false;
+    }
+    set_playhead_(frame_);
+    update_trackers_();
+
+    if (journal_.record_count() >= JOURNAL_COMPACT_RECORDS) {
+        compact_journal_();
+    }
+
+    return true;
+}
+
+bool MillikanTracker::load_frame_(size_t index) {
+    FrameCache::Entry * entry = frameCache_.find(index);
+    if (entry == nullptr) {
+        entry = decode_to_(index);
+        if (entry == nullptr) {
+            return false;
+        }
+    }
+
+    if (!entry->hasProcessed) {
+        load_mask_(index, entry->fgMask);
+        prepare_frame_(entry->source, preparedFrame_);
+        MaskKernels::masked_copy(preparedFrame_, entry->fgMask, entry->processed);
+        entry->hasProcessed = true;
+    }
+
+    //shallow copies, the entry is the most recently used so it outlives these until the next load
+    currentFrame_ = entry->source;
+    fgMask_ = entry->fgMask;
+    processedFrame_ = entry->processed;
+    pyramidValid_ = false;
+    frame_ = index + 1;
+
+    return true;
+}
+
+FrameCache::Entry * MillikanTracker::decode_to_(size_t index) {
+    //keep decoding forward if no keyframe lies between the decoder and the target, otherwise seek to
+    //the closest keyframe. every frame decoded on the way is cached so stepping back through the GOP hits
+    size_t keyframe = keyframeIndex_.keyframe_before(index);
+    if ((decodePos_ > index) || (decodePos_ < keyframe)) {
+        video_.set(cv::CAP_PROP_POS_FRAMES, keyframe);
+        decodePos_ = keyframe;
+    }
+
+    for (; decodePos_ < index; decodePos_++) {
+        if (frameCache_.contains(decodePos_)) {
+            if (!video_.grab()) {
+                return nullptr;
+            }
+        }
+        else if (!video_.read(frameCache_.acquire(decodePos_).source)) {
+            frameCache_.erase(decodePos_);
+            return nullptr;
+        }
+    }
+
+    FrameCache::Entry & entry = frameCache_.acquire(index);
+    if (!video_.read(entry.source)) {
+        frameCache_.erase(index);
+        return nullptr;
+    }
+    decodePos_++;
+
+    return &entry;
+}
+
+void MillikanTracker::load_mask_(size_t frame, cv::Mat & fgMask) {
+    {
+        std::unique_lock<std::mutex> lock(preprocessMutex_);
+        //a jump beyond the lead would otherwise wait on a producer held back by the old playhead, and
+        //retracking loads frames without moving the playhead at all
+        if (playhead_ < frame + 1) {
+            playhead_ = frame + 1;
+            preprocessCv_.notify_all();
+        }
+        preprocessCv_.wait(lock, [&]() { return preprocessDone_ || maskCache_.contains(frame); });
+        if (preprocessError_) {
+            std::rethrow_exception(preprocessError_);
+        }
+    }
+
+    if (!maskCache_.read(frame, fgMask)) {
+        fgMask.create(maskCache_.frame_size(), CV_8UC1);
+        fgMask.setTo(cv::Scalar::all(0));
+    }
+}
+
+cv::Ptr<cv::BackgroundSubtractor> MillikanTracker::create_background_subtractor_() {
+    return create_background_model(options_.backgroundModel, options_.backgroundParams);
+}
+
+void MillikanTracker::compute_mask_(cv::BackgroundSubtractor & subtractor, MaskKernels & kernels, const cv::Mat & frame, cv::Mat & rawMask, cv::Mat & fgMask) {
+    subtractor.apply(frame, rawMask);
+    kernels.median5(rawMask, fgMask);
 }
\ No newline at end of file
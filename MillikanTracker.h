@@ -1,79 +1,419 @@
-#pragma once
-
-#include <string>
-#include <vector>
-#include <unordered_set>
-#include <unordered_map>
-
-#include "opencv2/imgcodecs.hpp"
-#include "opencv2/highgui.hpp"
-#include "opencv2/imgproc.hpp"
-#include "opencv2/video.hpp"
-#include "opencv2/tracking.hpp"
-
-#include "Droplet.h"
-
-class MillikanTracker {
-public:
-	enum {
-		NONE = 0x0,
-		SHOW_PROCESSED = 0x1
-	};
-
-	MillikanTracker(const std::string & videoPath, const std::string & outputPath);
-
-	void load_video(const std::string & videoPath); //either private this or have it reinitialize
-
-	void show();
-
-	void finish();
-
-	template <typename TrackerType = cv::TrackerCSRT>
-	void new_droplet();
-	void prev_doplet();
-	void next_droplet();
-
-	void disable_tracker();
-	void reset_tracker();
-
-	bool next_frame();
-	bool prev_frame();
-	void beginning();
-
-	void load_data(const std::string & dataFilepath);
-
-	void load_keyframes(const std::string & keyframeFilepath);
-	void mark_keyframe();
-	void unmark_keyframe();
-	bool is_keyframe();
-
-	bool get_flag(unsigned char flag);
-	void set_flag(unsigned char flag, bool value);
-
-	size_t get_frame();
-
-	~MillikanTracker();
-private:
-	void update_trackers_();
-	void draw_overlay_(cv::Mat & image);
-	void process_frame_();
-
-	unsigned char flags_;
-
-	cv::VideoCapture video_;
-	cv::VideoCapture processedVideo_;
-	cv::Mat currentFrame_, processedFrame_;
-
-	cv::Ptr<cv::BackgroundSubtractor> backSub_;
-
-	std::vector<Droplet> trackedDroplets_;
-	size_t activeDropletInd_;
-
-	std::unordered_set<int> keyframes_;
-
-	std::string outputPath_;
-
-	static const size_t NO_DROPLET = -1;
-};
-
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/highgui.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/video.hpp"
+#include "opencv2/tracking.hpp"
+
+#include "BackgroundModels.h"
+#include "CentroidTracker.h"
+#include "Droplet.h"
+#include "DriftAnalysis.h"
+#include "DropletDetector.h"
+#include "FrameCache.h"
+#include "Journal.h"
+#include "OverlayLayer.h"
+#include "MaskCache.h"
+#include "MaskKernels.h"
+#include "PreprocessCache.h"
+#include "StageStats.h"
+#include "ThreadPool.h"
+#include "TrackStore.h"
+
+struct SessionOptions {
+	//number of independently processed chunks, 1 runs the ordered serial pipeline
+	size_t chunks = 1;
+	//frames fed to each chunk's background subtractor before the chunk starts
+	size_t warmupFrames = 500;
+	//frames after each chunk boundary to compare against a serial pass, 0 disables the check
+	size_t boundaryCheckFrames = 0;
+	//how far the background worker may run ahead of the playhead, 0 processes the whole video.
+	//only the serial pipeline is throttled, chunked preprocessing always runs to the end
+	size_t lead = 1000;
+	//finished preprocessing is kept here and reused whenever the same video is opened with the same
+	//settings, by any session or process. empty always preprocesses into ./temp
+	std::string preprocessCacheDir = "./cache";
+	//least recently used entries are deleted once the cache directory grows past this
+	uint64_t preprocessCacheBytes = (uint64_t)8 << 30;
+	//memory budget for decoded frames kept around the playhead
+	size_t frameCacheBytes = (size_t)1 << 30;
+	//threads updating droplet trackers, 0 uses one per hardware thread and 1 updates them serially
+	size_t trackerThreads = 0;
+	//part of the frame that is preprocessed and tracked, e.g. the band between the calibrated rule
+	//markings. empty processes the whole frame. droplet boxes and the exported data stay in full frame coordinates
+	cv::Rect roi;
+	//convert the region to a single channel once before subtraction, masking and tracking
+	bool grayscale = false;
+	//background model of the preprocessing, the subtract stage statistics give its cost per frame
+	BackgroundModel backgroundModel = BackgroundModel::MOG2;
+	BackgroundModelParams backgroundParams;
+	//trackers run on the processed frame halved with cv::pyrDown until it is at most this wide, and their
+	//boxes are refined on the full resolution mask, so their cost does not grow with the camera's
+	//resolution. 0 tracks at full resolution
+	int trackingWidth = 0;
+	//per-droplet motion model, which replaces tracker updates on frames where it is confidently right
+	MotionFilter::Params motion;
+	//bulk re-tracking merges a segment only where its forward and backward passes put each box centre
+	//within this fraction of the box's smaller side of each other
+	float retrackGate = 0.25f;
+	//settings for automatic droplet detection, used while the AUTO_DETECT flag is set
+	DropletDetector::Params detector;
+	//name of the highgui window, must differ between sessions shown side by side
+	std::string windowName = "millikan";
+	//frames are shown scaled by this, below 1 makes showing 4K footage cheaper. boxes selected on the
+	//preview are mapped back to full resolution
+	double previewScale = 1.0;
+	//no window is created and show/new_droplet/reset_tracker do nothing, for running without a display
+	bool headless = false;
+};
+
+//tracker updates since the video was loaded and how many of them the motion model replaced
+struct TrackerUsage {
+	size_t updates;
+	size_t skipped;
+};
+
+//one droplet's segment between two keyframes from a bulk re-tracking run. maxDisagreement is the
+//largest distance in pixels between the box centres of the forward and backward pass, infinite where
+//either lost the droplet. without a box at the closing keyframe the backward pass starts from the last
+//box of the forward pass and has to lead back to the opening keyframe box
+struct SegmentReport {
+	size_t droplet;
+	size_t firstFrame;
+	size_t lastFrame;
+	float maxDisagreement;
+	bool merged;
+};
+
+//fraction of mask pixels that disagree with the serial result after a chunk boundary
+struct ChunkBoundaryReport {
+	size_t chunk;
+	size_t startFrame;
+	size_t framesCompared;
+	double meanMismatch;
+	double maxMismatch;
+};
+
+class MillikanTracker {
+public:
+	enum {
+		NONE = 0x0,
+		SHOW_PROCESSED = 0x1,
+		AUTO_DETECT = 0x2
+	};
+
+	MillikanTracker(const std::string & videoPath, const std::string & outputPath, const SessionOptions & options = SessionOptions());
+
+	void load_video(const std::string & videoPath); //either private this or have it reinitialize
+
+	void show();
+	//the picture show() displays, i.e. the current or processed frame with the overlay, into image,
+	//reusing its buffer. touches no window, so it may run off the UI thread
+	void render(cv::Mat & image);
+
+	void finish();
+
+	template <typename TrackerType = cv::TrackerCSRT>
+	void new_droplet();
+	void prev_doplet();
+	void next_droplet();
+
+	void disable_tracker();
+	//reset the active droplet with a tracker of the type it was created with
+	void reset_tracker();
+	template <typename TrackerType>
+	void reset_tracker();
+	//re-track the active droplet from its last checkpoint at or before the shown frame up to the last
+	//frame it was tracked to, without drawing its box again. false if it has no tracker or checkpoint
+	bool retrack();
+	//re-tracks every droplet through every segment between consecutive keyframes on worker threads, from
+	//its box at the opening keyframe forward and from its box at the closing one backward. the session
+	//stays usable meanwhile. false if there is nothing to re-track or a run is still going
+	bool start_bulk_retrack();
+	bool bulk_retrack_running();
+	//once a run has finished, replaces the boxes of its segments in one step and returns true. segments
+	//whose passes disagree, or whose keyframes or keyframe boxes were edited since the start, are kept
+	bool merge_bulk_retrack();
+	//per droplet and segment outcome of the last merged run
+	const std::vector<SegmentReport> & get_segment_reports();
+
+	//drift velocities and charges of the current tracks, with the keyframes as the field switches. only
+	//tracks edited since the last call are refitted unless the calibration or keyframes changed
+	const DriftAnalysis & analyse(const Calibration & calibration, const DriftAnalysis::Params & params = DriftAnalysis::Params());
+
+	bool next_frame();
+	bool prev_frame();
+	void beginning();
+	//steps to the 1-based frame number get_frame() reports
+	bool go_to_frame(size_t frame);
+
+	//replaces all droplets with the tracks in a .txt or .trk file written by finish
+	void load_data(const std::string & dataFilepath);
+	//replays the edits journaled by a session on this output that ended without finish onto its .trk
+	//snapshot, replacing the loaded data, then snapshots the tracks and journals every edit from here on.
+	//call after load_data and load_keyframes. returns the number of edits recovered
+	size_t open_journal();
+	//the journal's first write failure or clamped box since it was opened, empty if none
+	std::string get_journal_error();
+
+	void load_keyframes(const std::string & keyframeFilepath);
+	void mark_keyframe();
+	void unmark_keyframe();
+	bool is_keyframe();
+
+	bool get_flag(unsigned char flag);
+	void set_flag(unsigned char flag, bool value);
+
+	size_t get_frame();
+	//frame rate stored in the video, 0 if the container has none
+	double get_fps();
+
+	//per stage (serial) or per chunk throughput of the last load_video, complete once preprocessing_done()
+	const std::vector<StageStats> & get_pipeline_stats();
+	const std::vector<ChunkBoundaryReport> & get_chunk_reports();
+	//tracker calls made and skipped by the motion model
+	const TrackerUsage & get_tracker_usage();
+	//hit and miss counters of the decoded frame cache
+	const FrameCache & get_frame_cache();
+	bool preprocessing_done();
+
+	~MillikanTracker();
+private:
+	//outcome of one droplet's update, elapsed is the number of frames since its last one
+	struct TrackerResult {
+		size_t elapsed;
+		bool found;
+		bool skipped;
+		cv::Rect bbox;
+	};
+
+	//a droplet's share of a bulk re-tracking segment, boxes in roi_ coordinates
+	struct BulkTrack {
+		size_t droplet;
+		cv::Ptr<cv::Tracker> (*createTracker)();
+		//the keyframe boxes as they were at the start, in full frame coordinates, to notice later edits
+		cv::Rect firstKey;
+		cv::Rect lastKey;
+		//the closing box is empty if the droplet has none there
+		cv::Rect firstBox;
+		cv::Rect lastBox;
+		//refine offsets of the box each pass started from
+		cv::Point2f forwardOffset;
+		cv::Point2f backwardOffset;
+		cv::Ptr<cv::Tracker> tracker;
+		//frame of the segment the backward pass starts from: the closing keyframe, or without a box there
+		//the last frame the forward pass found the droplet on. 0 if there is nothing to track back from
+		size_t backwardStart;
+		//one box per frame of the segment from each pass, empty where the tracker lost the droplet
+		std::vector<cv::Rect> forward;
+		std::vector<cv::Rect> backward;
+	};
+	struct BulkSegment {
+		size_t first;
+		size_t last;
+		std::vector<BulkTrack> tracks;
+		bool failed;
+	};
+	//a frame decoded and processed by a bulk worker, which keeps its own buffers
+	struct BulkFrame {
+		cv::Mat source, prepared, fgMask, processed;
+		std::vector<cv::Mat> pyramid;
+		cv::Mat tracking;
+	};
+
+	template <typename TrackerType>
+	static cv::Ptr<cv::Tracker> create_tracker_();
+	void reset_tracker_(cv::Ptr<cv::Tracker> (*createTracker)());
+
+	//the image trackers run on, processedFrame_ or its coarsest pyramid level, built once per frame
+	const cv::Mat & tracking_frame_();
+	void build_pyramid_(const cv::Mat & processed, std::vector<cv::Mat> & pyramid) const;
+	//box in roi_ coordinates to the tracking level and back. coming back, the box is refined by placing
+	//a full resolution box of boxSize around the centroid of fgMask near it
+	cv::Rect to_tracking_(const cv::Rect & box) const;
+	cv::Rect from_tracking_(const cv::Mat & fgMask, cv::Size boxSize, cv::Point2f refineOffset, const cv::Rect & box) const;
+	//offset from the centroid of fgMask inside box to the box centre
+	static cv::Point2f refine_offset_(const cv::Mat & fgMask, const cv::Rect & box);
+	//starts the droplet's tracker on box, in roi_ coordinates
+	void init_tracker_(Droplet & droplet, const cv::Rect & box);
+	//records a checkpoint at the current frame, dropping any later ones
+	void checkpoint_(Droplet & droplet, const cv::Rect & box);
+	void restore_checkpoint_(Droplet & droplet, const TrackerCheckpoint & checkpoint);
+	//steps droplet index alone from the shown frame, where its tracker is positioned, to frame to,
+	//replacing its boxes on the way, and shows the starting frame again
+	void retrack_to_(size_t index, size_t to);
+	//restarts trackers that a bulk merge moved past where they were, from their last checkpoint
+	void resume_stale_trackers_();
+	//both passes over one segment, on a bulk worker
+	void run_bulk_segment_(BulkSegment & segment);
+	//reads the next frame of capture, which is frame index, and processes it like load_frame_ does
+	bool read_bulk_frame_(cv::VideoCapture & capture, size_t index, BulkFrame & frame);
+	void merge_bulk_track_(const BulkSegment & segment, const BulkTrack & track);
+	void stop_bulk_retrack_();
+	//one droplet's tracker update, or the motion model's stand-in, on the current frame
+	void track_droplet_(Droplet & droplet, const cv::Mat & trackingFrame, TrackerResult & result) const;
+	void store_result_(size_t index, const TrackerResult & result);
+	void update_trackers_();
+	//predicts droplet elapsed frames ahead and, if the mask centroid near the prediction confidently
+	//agrees with it, puts box there instead of running the tracker. safe to run for several droplets at once
+	bool follow_motion_(Droplet & droplet, size_t elapsed, cv::Rect & box) const;
+	//feeds a box the tracker returned to the motion model
+	void observe_tracker_(Droplet & droplet, const cv::Rect & box) const;
+	void detect_droplets_();
+	//redraws overlay_ for the current frame, in preview coordinates
+	void draw_overlay_();
+	//every track and keyframe edit goes through these or the journal, so the journal stays complete
+	void set_box_(size_t track, size_t frame, const cv::Rect & box);
+	void erase_box_(size_t track, size_t frame);
+	//adds inactive droplets for tracks loaded from disk that have none yet
+	void adopt_tracks_();
+	void save_keyframes_();
+	//snapshots the tracks and keyframes and empties the journal
+	void compact_journal_();
+	//preview sized picture with the overlay for display and box selection, the processed region is
+	//placed at roi_ in an otherwise black frame. the overlay is only redrawn when what it shows changed
+	void render_(bool processed, cv::Mat & image);
+	cv::Size preview_size_() const;
+	double preview_scale_() const;
+	cv::Rect to_preview_(const cv::Rect & rect) const;
+	cv::Rect from_preview_(const cv::Rect & rect) const;
+	//crop to roi_ and convert to the processed colour format, shallow when there is nothing to do
+	void prepare_frame_(const cv::Mat & frame, cv::Mat & prepared) const;
+	//everything the masks depend on besides the video, part of the preprocess cache key
+	std::string preprocess_settings_() const;
+	void run_preprocessing_(std::string videoPath);
+	void stop_preprocessing_();
+	void cancel_preprocessing_();
+	bool wait_for_playhead_(size_t frame);
+	void store_mask_(size_t frame, const cv::Mat & fgMask);
+	void set_playhead_(size_t frame);
+	void preprocess_pipelined_(const std::string & videoPath);
+	void preprocess_chunked_(const std::string & videoPath);
+	//positions capture so the next read returns frame. seeks are not frame exact for many codecs, so the
+	//position is read back and a decoder that landed elsewhere is decoded forward to frame, from the start
+	//of the video if it overshot. false if the video ends before frame
+	static bool seek_exact_(cv::VideoCapture & capture, const std::string & videoPath, size_t frame);
+	bool step_to_(size_t index);
+	bool load_frame_(size_t index);
+	FrameCache::Entry * decode_to_(size_t index);
+	void load_mask_(size_t frame, cv::Mat & fgMask);
+	cv::Ptr<cv::BackgroundSubtractor> create_background_subtractor_();
+	static void compute_mask_(cv::BackgroundSubtractor & subtractor, MaskKernels & kernels, const cv::Mat & frame, cv::Mat & rawMask, cv::Mat & fgMask);
+
+	unsigned char flags_;
+	SessionOptions options_;
+
+	cv::VideoCapture video_;
+	size_t frameCount_;
+	double fps_;
+	//frame_ is the 1-based number of the frame on screen, decodePos_ the 0-based index video_ reads next
+	size_t frame_, decodePos_;
+	FrameCache frameCache_;
+	KeyframeIndex keyframeIndex_;
+	std::thread keyframeIndexer_;
+	MaskCache maskCache_;
+	//fgMask_ and processedFrame_ cover roi_ only, currentFrame_ is the full decoded frame
+	cv::Rect roi_;
+	cv::Mat currentFrame_, fgMask_, processedFrame_, preparedFrame_;
+	//pyramid levels of processedFrame_ for the trackers, valid for the loaded frame while pyramidValid_
+	std::vector<cv::Mat> pyramid_;
+	bool pyramidValid_;
+	int trackingLevels_;
+
+	//persistent display buffers: what show() and box selection draw into, and the full size frame the
+	//processed band is placed in when only roi_ is processed
+	cv::Mat displayBuffer_, bandBuffer_;
+	//everything the overlay depends on, it is redrawn when this changes
+	struct OverlayKey {
+		size_t frame;
+		size_t activeDroplet;
+		bool keyframe;
+		uint64_t revision;
+		cv::Size size;
+
+		bool operator==(const OverlayKey & other) const = default;
+	};
+	OverlayLayer overlay_;
+	OverlayKey overlayKey_{};
+
+	cv::Ptr<cv::BackgroundSubtractor> backSub_;
+	MaskKernels preprocessKernels_;
+
+	//tracks_ holds the boxes of trackedDroplets_[i] as track i, both grow together
+	std::vector<Droplet> trackedDroplets_;
+	TrackStore tracks_;
+	size_t activeDropletInd_;
+
+	std::unique_ptr<ThreadPool> trackerPool_;
+	std::vector<size_t> pendingUpdates_;
+	std::vector<TrackerResult> trackerResults_;
+	TrackerUsage trackerUsage_{};
+
+	DropletDetector detector_;
+	size_t detectorFrameLast_;
+	std::vector<size_t> detectedTracks_;
+	std::vector<cv::Point2f> detectedPredictions_;
+	std::vector<size_t> detectedAssignment_;
+
+	std::unordered_set<int> keyframes_;
+
+	std::string outputPath_;
+	std::string maskCachePath_;
+	std::unique_ptr<PreprocessCache> preprocessCache_;
+	std::string preprocessKey_;
+	//temporary file in the preprocess cache being written, empty once published or without a cache
+	std::string pendingCachePath_;
+	std::string journalPath_;
+	Journal journal_;
+
+	//background preprocessing, guarded by preprocessMutex_
+	std::thread preprocessWorker_;
+	std::mutex preprocessMutex_;
+	std::condition_variable preprocessCv_;
+	std::atomic<bool> cancelPreprocess_;
+	size_t playhead_;
+	bool preprocessDone_;
+	std::exception_ptr preprocessError_;
+
+	std::vector<StageStats> pipelineStats_;
+	std::vector<ChunkBoundaryReport> chunkReports_;
+
+	//bulk re-tracking, bulkSegments_ belongs to the workers until bulkDone_
+	std::string videoPath_;
+	std::unique_ptr<ThreadPool> bulkPool_;
+	std::thread bulkWorker_;
+	std::vector<BulkSegment> bulkSegments_;
+	std::atomic<bool> bulkDone_;
+	std::atomic<bool> cancelBulk_;
+	//lifts the lead limit of the preprocessing while bulk workers need masks anywhere in the video,
+	//guarded by preprocessMutex_
+	bool unthrottled_;
+	std::vector<SegmentReport> segmentReports_;
+	DriftAnalysis analysis_;
+
+	static const size_t NO_DROPLET = -1;
+	static const size_t PIPELINE_DEPTH = 8;
+	//part of the preprocess cache key, bump when prepare_frame_ or compute_mask_ change their output
+	static const int PREPROCESS_VERSION = 1;
+	//frames between a tracker droplet's checkpoints, at most this many are re-tracked needlessly
+	static const size_t CHECKPOINT_INTERVAL = 25;
+	//frames a bulk worker decodes forward at a time to walk them backward
+	static const size_t BACKWARD_BLOCK = 32;
+	//journal length that triggers a snapshot, which bounds recovery to replaying this many records
+	static const size_t JOURNAL_COMPACT_RECORDS = (size_t)1 << 20;
+
+};
+
 #include "MillikanTracker.ipp"
\ No newline at end of file
@@ -1,30 +1,46 @@
-#ifndef MILLIKAN_TRACKER_IPP
-#define MILLIKAN_TRACKER_IPP
-
-#include "MillikanTracker.h"
-
-template <typename TrackerType>
-void MillikanTracker::new_droplet() {
-	size_t prevActiveDroplet = activeDropletInd_;
-	activeDropletInd_ = NO_DROPLET;
-
-	cv::Mat overlayed = processedFrame_.clone();
-	draw_overlay_(overlayed);
-	cv::Rect rect = cv::selectROI("millikan", overlayed, false, true);
-
-	if (!rect.empty()) {
-		activeDropletInd_ = trackedDroplets_.size();
-		trackedDroplets_.emplace_back();
-		auto & activeDrop = trackedDroplets_.back();
-		activeDrop.active = true;
-		activeDrop.tracker = TrackerType::create();
-		activeDrop.tracker->init(processedFrame_, rect);
-		activeDrop.frameLastUpdated = get_frame();
-		activeDrop.bbox[get_frame()] = rect;
-	}
-	else {
-		activeDropletInd_ = prevActiveDroplet;
-	}
-}
-
+#ifndef MILLIKAN_TRACKER_IPP
+#define MILLIKAN_TRACKER_IPP
+
+#include "MillikanTracker.h"
+
+template <typename TrackerType>
+void MillikanTracker::new_droplet() {
+	if (options_.headless) {
+		return;
+	}
+
+	size_t prevActiveDroplet = activeDropletInd_;
+	activeDropletInd_ = NO_DROPLET;
+
+	render_(true, displayBuffer_);
+	//selected on the preview, the tracker only sees the full resolution part inside roi_
+	cv::Rect rect = from_preview_(cv::selectROI(options_.windowName, displayBuffer_, false, true)) & roi_;
+
+	if (!rect.empty()) {
+		activeDropletInd_ = trackedDroplets_.size();
+		trackedDroplets_.emplace_back();
+		tracks_.add_track();
+		auto & activeDrop = trackedDroplets_.back();
+		activeDrop.active = true;
+		activeDrop.createTracker = &create_tracker_<TrackerType>;
+		activeDrop.tracker = activeDrop.createTracker();
+		init_tracker_(activeDrop, rect - roi_.tl());
+		activeDrop.frameLastUpdated = get_frame();
+		set_box_(activeDropletInd_, get_frame(), rect);
+	}
+	else {
+		activeDropletInd_ = prevActiveDroplet;
+	}
+}
+
+template <typename TrackerType>
+void MillikanTracker::reset_tracker() {
+	reset_tracker_(&create_tracker_<TrackerType>);
+}
+
+template <typename TrackerType>
+cv::Ptr<cv::Tracker> MillikanTracker::create_tracker_() {
+	return TrackerType::create();
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include "MotionFilter.h"
+
+MotionFilter::Params::Params() :
+    accelerationNoise(0.05f),
+    measurementNoise(1.0f),
+    initialSpeedVariance(25.0f),
+    skipTracker(true),
+    lockFrames(3),
+    skipGate(5.99f),
+    resetGate(13.8f),
+    searchScale(1.5f),
+    minAreaRatio(0.5f),
+    maxAreaRatio(2.0f),
+    maxDrift(0.5f)
+{}
+
+MotionFilter::MotionFilter() : x_{}, y_{}, accelerationNoise_(0.0f), measurementNoise_(1.0f), initialized_(false) {}
+
+void MotionFilter::init(cv::Point2f position, const Params & parameters) {
+    x_ = { position.x, 0.0f, parameters.measurementNoise, 0.0f, parameters.initialSpeedVariance };
+    y_ = { position.y, 0.0f, parameters.measurementNoise, 0.0f, parameters.initialSpeedVariance };
+    accelerationNoise_ = parameters.accelerationNoise;
+    measurementNoise_ = parameters.measurementNoise;
+    initialized_ = true;
+}
+
+bool MotionFilter::initialized() const {
+    return initialized_;
+}
+
+void MotionFilter::predict(float frames) {
+    predict_(x_, frames);
+    predict_(y_, frames);
+}
+
+float MotionFilter::innovation(cv::Point2f measured) const {
+    float dx = measured.x - x_.position;
+    float dy = measured.y - y_.position;
+    return dx * dx / (x_.pp + measurementNoise_) + dy * dy / (y_.pp + measurementNoise_);
+}
+
+void MotionFilter::correct(cv::Point2f measured) {
+    correct_(x_, measured.x);
+    correct_(y_, measured.y);
+}
+
+cv::Point2f MotionFilter::position() const {
+    return cv::Point2f(x_.position, y_.position);
+}
+cv::Point2f MotionFilter::velocity() const {
+    return cv::Point2f(x_.velocity, y_.velocity);
+}
+
+void MotionFilter::predict_(Axis & axis, float frames) const {
+    //F = [1 t; 0 1], Q is the white noise acceleration model q * [t^4/4 t^3/2; t^3/2 t^2]
+    float t = frames;
+    float q = accelerationNoise_;
+    axis.position += axis.velocity * t;
+    axis.pp += 2.0f * t * axis.pv + t * t * axis.vv + q * t * t * t * t / 4.0f;
+    axis.pv += t * axis.vv + q * t * t * t / 2.0f;
+    axis.vv += q * t * t;
+}
+
+void MotionFilter::correct_(Axis & axis, float measured) const {
+    float s = axis.pp + measurementNoise_;
+    float kp = axis.pp / s;
+    float kv = axis.pv / s;
+    float residual = measured - axis.position;
+    axis.position += kp * residual;
+    axis.velocity += kv * residual;
+    //P = (I - K H) P, in the order that reads the old values
+    axis.vv -= kv * axis.pv;
+    axis.pv -= kp * axis.pv;
+    axis.pp -= kp * axis.pp;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+
+//constant-velocity Kalman filter of a droplet centre. droplets move almost linearly between field
+//reversals, so the prediction is usually within a pixel of where the droplet is found. the axes are
+//independent, which makes the filter two separate two-state filters with closed form updates
+class MotionFilter {
+public:
+	struct Params {
+		Params();
+
+		//variance of the change in velocity per frame, in px^2 / frame^2
+		float accelerationNoise;
+		//variance of a measured centre, in px^2
+		float measurementNoise;
+		//velocity variance of a newly started filter, large so the first measurements set the velocity
+		float initialSpeedVariance;
+
+		//let the mask centroid stand in for the tracker on frames where it agrees with the prediction
+		bool skipTracker;
+		//frames of agreeing measurements before the tracker is first skipped
+		size_t lockFrames;
+		//largest normalised innovation (chi-square, 2 degrees of freedom) of a centroid that may replace
+		//the tracker. 5.99 is the 95% quantile
+		float skipGate;
+		//normalised innovation of a tracker result above which the filter restarts from it, e.g. at a
+		//field reversal. 13.8 is the 99.9% quantile
+		float resetGate;
+		//centroid search window size relative to the box
+		float searchScale;
+		//foreground area in the search window relative to the area when the tracker last ran, outside
+		//this range another droplet or noise is in the window and the tracker runs
+		float minAreaRatio;
+		float maxAreaRatio;
+		//the tracker's own position goes stale while it is skipped. it runs again once the prediction is
+		//this many box sizes away from where it last put the droplet, well inside its search region
+		float maxDrift;
+	};
+
+	MotionFilter();
+
+	void init(cv::Point2f position, const Params & parameters);
+	bool initialized() const;
+
+	//advance the state by frames
+	void predict(float frames);
+	//normalised innovation squared of a measurement against the current prediction
+	float innovation(cv::Point2f measured) const;
+	void correct(cv::Point2f measured);
+
+	cv::Point2f position() const;
+	cv::Point2f velocity() const;
+private:
+	struct Axis {
+		float position;
+		float velocity;
+		//covariance of position and velocity
+		float pp;
+		float pv;
+		float vv;
+	};
+
+	void predict_(Axis & axis, float frames) const;
+	void correct_(Axis & axis, float measured) const;
+
+	Axis x_, y_;
+	float accelerationNoise_;
+	float measurementNoise_;
+	bool initialized_;
+};
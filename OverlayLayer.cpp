@@ -0,0 +1,48 @@
+#include "OverlayLayer.h"
+
+void OverlayLayer::begin(cv::Size size) {
+    if (layer_.size() != size) {
+        layer_.create(size, CV_8UC3);
+        mask_.create(size, CV_8UC1);
+        layer_.setTo(cv::Scalar::all(0));
+        mask_.setTo(cv::Scalar::all(0));
+    }
+    else {
+        for (const cv::Rect & region : regions_) {
+            layer_(region).setTo(cv::Scalar::all(0));
+            mask_(region).setTo(cv::Scalar::all(0));
+        }
+    }
+    regions_.clear();
+}
+
+void OverlayLayer::rectangle(const cv::Rect & rect, const cv::Scalar & color) {
+    //compose copies whole pixels, so only aliased lines reach the image without a dark fringe
+    cv::rectangle(layer_, rect, color, 1, cv::LINE_8);
+    cv::rectangle(mask_, rect, cv::Scalar(255), 1, cv::LINE_8);
+    mark_(cv::Rect(rect.x - 1, rect.y - 1, rect.width + 2, rect.height + 2));
+}
+
+void OverlayLayer::text(const std::string & text, cv::Point origin, double scale, const cv::Scalar & color) {
+    cv::putText(layer_, text, origin, cv::FONT_HERSHEY_SIMPLEX, scale, color);
+    cv::putText(mask_, text, origin, cv::FONT_HERSHEY_SIMPLEX, scale, cv::Scalar(255));
+
+    int baseline = 0;
+    cv::Size size = cv::getTextSize(text, cv::FONT_HERSHEY_SIMPLEX, scale, 1, &baseline);
+    mark_(cv::Rect(origin.x - 1, origin.y - size.height - 1, size.width + 2, size.height + baseline + 2));
+}
+
+void OverlayLayer::compose(cv::Mat & image) const {
+    CV_Assert((image.size() == layer_.size()) && (image.type() == CV_8UC3));
+    for (const cv::Rect & region : regions_) {
+        cv::Mat target = image(region);
+        layer_(region).copyTo(target, mask_(region));
+    }
+}
+
+void OverlayLayer::mark_(const cv::Rect & region) {
+    cv::Rect clipped = region & cv::Rect(cv::Point(0, 0), layer_.size());
+    if (!clipped.empty()) {
+        regions_.push_back(clipped);
+    }
+}
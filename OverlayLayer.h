@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+
+//annotations drawn once into a layer of their own and copied onto every frame they are shown on.
+//the layer remembers the regions it drew into, so composing and clearing it for the next redraw
+//only touch those instead of the whole frame
+class OverlayLayer {
+public:
+	//clears what was drawn before and starts a new drawing on a layer of the given size
+	void begin(cv::Size size);
+	void rectangle(const cv::Rect & rect, const cv::Scalar & color);
+	void text(const std::string & text, cv::Point origin, double scale, const cv::Scalar & color);
+
+	//copies the drawn pixels onto image, which must be 3 channel and of the layer's size
+	void compose(cv::Mat & image) const;
+private:
+	void mark_(const cv::Rect & region);
+
+	cv::Mat layer_, mask_;
+	std::vector<cv::Rect> regions_;
+};
@@ -0,0 +1,192 @@
+#include "PlaybackEngine.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "opencv2/highgui.hpp"
+
+PlaybackEngine::PlaybackEngine(MillikanTracker & tracker, const std::string & windowName, double fps) :
+    tracker_(tracker),
+    windowName_(windowName),
+    slots_(DEPTH),
+    cancel_(false),
+    running_(false),
+    shownFrame_(0),
+    stats_{ 0, 0, 0 }
+{
+    if (fps <= 0.0) {
+        fps = tracker_.get_fps();
+    }
+    //containers without a usable rate play at 30 fps
+    if (!(fps > 0.0)) {
+        fps = 30.0;
+    }
+    period_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+}
+
+void PlaybackEngine::start() {
+    if (running_) {
+        return;
+    }
+
+    //fresh queues, as the producer may have been stopped holding a slot
+    freeSlots_ = std::make_unique<SpscQueue<size_t>>(DEPTH);
+    readySlots_ = std::make_unique<SpscQueue<size_t>>(DEPTH + 1);
+    for (size_t i = 0; i < DEPTH; i++) {
+        freeSlots_->push(i);
+    }
+
+    shownFrame_ = tracker_.get_frame();
+    due_ = Clock::now();
+    cancel_ = false;
+    running_ = true;
+    producer_ = std::thread(&PlaybackEngine::produce_, this);
+}
+
+void PlaybackEngine::stop() {
+    if (!running_) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(slotMutex_);
+        cancel_ = true;
+    }
+    slotFreed_.notify_all();
+    producer_.join();
+    running_ = false;
+
+    //commands posted after the producer's last frame still have to happen
+    std::vector<std::function<void(MillikanTracker &)>> commands;
+    {
+        std::lock_guard<std::mutex> lock(commandMutex_);
+        commands.swap(commands_);
+    }
+    for (auto & command : commands) {
+        command(tracker_);
+    }
+
+    if ((shownFrame_ != 0) && (tracker_.get_frame() != shownFrame_)) {
+        tracker_.go_to_frame(shownFrame_);
+    }
+
+    std::cout << "playback: " << stats_.presented << " frames shown, " << stats_.late << " late, " << stats_.dropped << " dropped" << std::endl;
+}
+
+bool PlaybackEngine::running() const {
+    return running_;
+}
+
+bool PlaybackEngine::present() {
+    Clock::time_point now = Clock::now();
+    if (!running_ || (now < due_)) {
+        return true;
+    }
+
+    size_t slot;
+    if (!readySlots_->try_pop(slot)) {
+        //the producer is behind, the frame will be shown late once it arrives
+        return true;
+    }
+
+    //a frame whose successor is also due already is skipped, as long as it does not end playback
+    int behind = (int)((now - due_) / period_);
+    size_t next;
+    while ((behind > 0) && (slot != END_OF_STREAM) && !slots_[slot].last && readySlots_->try_pop(next)) {
+        release_slot_(slot);
+        slot = next;
+        stats_.dropped++;
+        due_ += period_;
+        behind--;
+    }
+
+    if (slot == END_OF_STREAM) {
+        return false;
+    }
+
+    Slot & s = slots_[slot];
+    cv::imshow(windowName_, s.image);
+    shownFrame_ = s.frame;
+    bool last = s.last;
+    release_slot_(slot);
+
+    stats_.presented++;
+    if (now - due_ > period_ / 2) {
+        stats_.late++;
+    }
+    //after a long stall restart the schedule rather than rushing through the backlog
+    due_ = (now - due_ > MAX_BEHIND * period_) ? now + period_ : due_ + period_;
+
+    return !last;
+}
+
+int PlaybackEngine::wait_ms() const {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(due_ - Clock::now()).count();
+    return (int)std::max<long long>(1, remaining);
+}
+
+void PlaybackEngine::post(std::function<void(MillikanTracker &)> command) {
+    if (!running_) {
+        command(tracker_);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(commandMutex_);
+    commands_.push_back(std::move(command));
+}
+
+const PlaybackStats & PlaybackEngine::get_stats() const {
+    return stats_;
+}
+
+PlaybackEngine::~PlaybackEngine() {
+    stop();
+}
+
+void PlaybackEngine::produce_() {
+    std::vector<std::function<void(MillikanTracker &)>> commands;
+    size_t slot;
+    while (take_free_slot_(slot)) {
+        {
+            std::lock_guard<std::mutex> lock(commandMutex_);
+            commands.swap(commands_);
+        }
+        for (auto & command : commands) {
+            command(tracker_);
+        }
+        commands.clear();
+
+        if (!tracker_.next_frame()) {
+            readySlots_->push(END_OF_STREAM, cancel_);
+            break;
+        }
+
+        Slot & s = slots_[slot];
+        tracker_.render(s.image);
+        s.frame = tracker_.get_frame();
+        s.last = tracker_.is_keyframe();
+        if (!readySlots_->push(slot, cancel_) || s.last) {
+            break;
+        }
+    }
+}
+
+bool PlaybackEngine::take_free_slot_(size_t & slot) {
+    while (!freeSlots_->try_pop(slot)) {
+        //every slot is waiting to be shown, sleep instead of spinning until the UI thread frees one
+        std::unique_lock<std::mutex> lock(slotMutex_);
+        slotFreed_.wait_for(lock, std::chrono::milliseconds(5), [this]() { return cancel_.load(); });
+        if (cancel_) {
+            return false;
+        }
+    }
+    return !cancel_;
+}
+
+void PlaybackEngine::release_slot_(size_t slot) {
+    freeSlots_->push(slot);
+    {
+        std::lock_guard<std::mutex> lock(slotMutex_);
+    }
+    slotFreed_.notify_one();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+#include "MillikanTracker.h"
+#include "SpscQueue.h"
+
+struct PlaybackStats {
+	//frames shown, shown more than half a frame period after their due time, and skipped to catch up
+	size_t presented;
+	size_t late;
+	size_t dropped;
+};
+
+//plays a session at a fixed rate independent of how long tracking takes. a producer thread steps the
+//tracker and renders each frame with its overlay into a small ring of reused images, while the UI
+//thread only shows the frame that is due and handles keys. every frame is still tracked, frames are
+//only skipped on screen when presentation falls behind.
+//while running, the tracker belongs to the producer thread: change it through post() or after stop()
+class PlaybackEngine {
+public:
+	//fps 0 plays at the video's frame rate
+	PlaybackEngine(MillikanTracker & tracker, const std::string & windowName, double fps = 0.0);
+
+	PlaybackEngine(const PlaybackEngine &) = delete;
+	PlaybackEngine & operator=(const PlaybackEngine &) = delete;
+
+	void start();
+	//stops the producer and moves the tracker back to the last frame shown, which it may have run ahead of
+	void stop();
+	bool running() const;
+
+	//shows the due frame, if any. false once the last frame or a keyframe has been shown, after which
+	//the caller should stop()
+	bool present();
+	//milliseconds until the next frame is due, at least 1 so it can be passed to cv::waitKey
+	int wait_ms() const;
+
+	//runs command on the producer thread before its next frame, or right away when not running
+	void post(std::function<void(MillikanTracker &)> command);
+
+	const PlaybackStats & get_stats() const;
+
+	~PlaybackEngine();
+
+	static const size_t DEPTH = 8;
+	//behind by more than this many frame periods, the schedule restarts from now instead of skipping ahead
+	static const int MAX_BEHIND = 4;
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Slot {
+		cv::Mat image;
+		size_t frame;
+		//last frame to play, because it is a keyframe or the video ends after it
+		bool last;
+	};
+
+	//freeSlots_ is only pushed by the UI thread and popped by the producer, readySlots_ the other way round
+	void produce_();
+	bool take_free_slot_(size_t & slot);
+	void release_slot_(size_t slot);
+
+	MillikanTracker & tracker_;
+	std::string windowName_;
+	Clock::duration period_;
+
+	std::vector<Slot> slots_;
+	std::unique_ptr<SpscQueue<size_t>> freeSlots_, readySlots_;
+	std::thread producer_;
+	std::atomic<bool> cancel_;
+	bool running_;
+	//the producer sleeps on slotFreed_ while every slot is queued for display
+	std::mutex slotMutex_;
+	std::condition_variable slotFreed_;
+
+	std::mutex commandMutex_;
+	std::vector<std::function<void(MillikanTracker &)>> commands_;
+
+	Clock::time_point due_;
+	size_t shownFrame_;
+	PlaybackStats stats_;
+
+	static const size_t END_OF_STREAM = -1;
+};
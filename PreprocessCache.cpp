@@ -0,0 +1,144 @@
+#include "PreprocessCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace {
+    const uint64_t FNV_OFFSET = 14695981039346656037ull;
+    const uint64_t FNV_PRIME = 1099511628211ull;
+
+    //videos are hashed on their size and this many evenly spaced blocks, so the key of a multi-gigabyte
+    //file costs a few megabytes of reading. files up to SAMPLE_BLOCKS * BLOCK_BYTES are hashed whole
+    const size_t SAMPLE_BLOCKS = 64;
+    const size_t BLOCK_BYTES = 64 * 1024;
+
+    //FNV-1a a word at a time, the tail bytewise
+    uint64_t hash_bytes(uint64_t hash, const unsigned char * data, size_t size) {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * FNV_PRIME;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ data[i]) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    std::string to_hex(uint64_t value) {
+        static const char DIGITS[] = "0123456789abcdef";
+        std::string hex(16, '0');
+        for (int i = 15; i >= 0; i--) {
+            hex[i] = DIGITS[value & 0xf];
+            value >>= 4;
+        }
+        return hex;
+    }
+
+    bool has_suffix(const std::string & name, const std::string & suffix) {
+        return (name.size() >= suffix.size()) && (name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0);
+    }
+}
+
+PreprocessCache::PreprocessCache(const std::string & directory, uint64_t budgetBytes) :
+    directory_(directory),
+    budgetBytes_(budgetBytes)
+{
+    std::filesystem::create_directories(directory_);
+}
+
+std::string PreprocessCache::make_key(const std::string & videoPath, const std::string & settings) {
+    MappedFile video(videoPath);
+    uint64_t size = video.size();
+
+    uint64_t content = hash_bytes(FNV_OFFSET, (const unsigned char *)&size, sizeof(size));
+    if (size <= SAMPLE_BLOCKS * BLOCK_BYTES) {
+        content = hash_bytes(content, video.data(), size);
+    }
+    else {
+        //the first block starts at the beginning and the last one ends at the end of the file
+        for (size_t i = 0; i < SAMPLE_BLOCKS; i++) {
+            uint64_t offset = (size - BLOCK_BYTES) * i / (SAMPLE_BLOCKS - 1);
+            content = hash_bytes(content, video.data() + offset, BLOCK_BYTES);
+        }
+    }
+
+    uint64_t settingsHash = hash_bytes(FNV_OFFSET, (const unsigned char *)settings.data(), settings.size());
+    return to_hex(content) + to_hex(settingsHash);
+}
+
+std::string PreprocessCache::find(const std::string & key) {
+    std::string path = entry_path(key);
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+        return "";
+    }
+    //the modification time is the last use, eviction goes by it
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    return path;
+}
+
+std::string PreprocessCache::entry_path(const std::string & key) const {
+    return (std::filesystem::path(directory_) / (key + ".msk")).string();
+}
+
+std::string PreprocessCache::temporary_path(const std::string & key) const {
+    thread_local std::mt19937_64 generator(std::random_device{}());
+    return (std::filesystem::path(directory_) / (key + "." + to_hex(generator()) + ".tmp")).string();
+}
+
+void PreprocessCache::evict(const std::string & keep) {
+    struct Entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type used;
+        uint64_t size;
+    };
+
+    //every step tolerates files that other processes delete or rename in the meantime
+    std::error_code error;
+    auto now = std::filesystem::file_time_type::clock::now();
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    for (std::filesystem::directory_iterator it(directory_, error), end; !error && (it != end); it.increment(error)) {
+        std::string name = it->path().filename().string();
+        std::error_code entryError;
+        auto used = std::filesystem::last_write_time(it->path(), entryError);
+        uint64_t size = std::filesystem::file_size(it->path(), entryError);
+        if (entryError) {
+            continue;
+        }
+
+        if (has_suffix(name, ".tmp")) {
+            if (now - used > std::chrono::hours(STALE_TEMPORARY_HOURS)) {
+                std::filesystem::remove(it->path(), entryError);
+            }
+        }
+        else if (has_suffix(name, ".msk")) {
+            entries.push_back({ it->path(), used, size });
+            total += size;
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) { return a.used < b.used; });
+    for (const Entry & entry : entries) {
+        if (total <= budgetBytes_) {
+            break;
+        }
+        if (entry.path == std::filesystem::path(keep)) {
+            continue;
+        }
+        //a process still reading the entry keeps its mapping where deleting it succeeds, and on systems
+        //where open files cannot be deleted the entry simply stays until a later eviction
+        std::error_code removeError;
+        if (std::filesystem::remove(entry.path, removeError)) {
+            total -= entry.size;
+        }
+    }
+}
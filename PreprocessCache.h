@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//finished mask caches kept between sessions in a directory shared by every tracker process, one
+//<key>.msk file per video and preprocessing settings. entries are written under a temporary name and
+//renamed into place, so no process ever opens a partial one. a hit refreshes the entry's modification
+//time and the least recently used entries are deleted once the directory outgrows its budget
+class PreprocessCache {
+public:
+	PreprocessCache(const std::string & directory, uint64_t budgetBytes);
+
+	//key of a video's masks under the given settings, which must name everything that changes them
+	static std::string make_key(const std::string & videoPath, const std::string & settings);
+
+	//path of the finished entry for key, or empty if there is none
+	std::string find(const std::string & key);
+	//where key's entry ends up
+	std::string entry_path(const std::string & key) const;
+	//a fresh name to write key's entry under before moving it to entry_path
+	std::string temporary_path(const std::string & key) const;
+
+	//deletes the least recently used entries until the directory fits the budget, and temporary files
+	//left behind by processes that died while writing. keep is never deleted
+	void evict(const std::string & keep = "");
+
+	//temporary files older than this belong to a process that is gone
+	static const int STALE_TEMPORARY_HOURS = 24;
+private:
+	std::string directory_;
+	uint64_t budgetBytes_;
+};
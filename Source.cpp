@@ -1,343 +1,793 @@
-#include <iostream>
-#include <filesystem>
-#include <string>
-#include <fstream>
-#include <set>
-
-#include <nlohmann/json.hpp>
-
-#include "opencv2/highgui.hpp"
-
-#include "MillikanTracker.h"
-
-static const std::unordered_map<std::string, std::string> controlInfo = {
-    {"finish", "Finish"},
-    {"pause", "Play / Pause"},
-    {"keyframe", "Mark Keyframe"},
-    {"remKeyframe", "Unmark Keyframe"},
-    {"restart", "Restart Video"},
-    {"forward", "Next Frame"},
-    {"back", "Previous Frame"},
-    {"view", "Toggle Processed View"},
-    {"new", "New Droplet"},
-    {"nextDrop", "Next Droplet"},
-    {"prevDrop", "Previous Droplet"},
-    {"resTracker", "Reset Tracker"},
-    {"disTracker", "Disable Tracker"}
-};
-
-std::unordered_map<std::string, int> mappings;
-template <typename It>
-void get_mappings(It nameBeg, It nameEnd);
-
-void calibration();
-void data_collection();
-
-int main() {
-    bool running = true;
-    while (running) {
-        std::cout << "Please select mode:" << std::endl;
-        std::cout << "\t1: Calibration" << std::endl;
-        std::cout << "\t2: Data Collection" << std::endl;
-
-        int inp;
-        std::cin >> inp;
-        while (std::cin.fail() || (inp < 1) || (inp > 2)) {
-            std::cout << "Please enter a number between 1 and 2." << std::endl;
-            std::cin.clear();
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            std::cin >> inp;
-        }
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-        
-        
-        switch (inp) {
-        case 1:
-            calibration();
-            break;
-        case 2:
-            data_collection();
-            break;
-        }
-
-        char answer;
-        std::cout << "Would you like to analyse another video? (y/n)" << std::endl;
-        std::cin >> answer;
-        while ((answer != 'y') && (answer != 'n')) {
-            std::cout << "y/n only." << std::endl;
-            std::cout << "Would you like to analyse another video? (y/n)" << std::endl;
-            std::cin >> answer;
-        }
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-        running = (answer == 'y');
-    }
-    
-    return 0;
-}
-
-template <typename It>
-void get_mappings(It nameBeg, It nameEnd) {
-    using nlohmann::json;
-    static bool mapped = false;
-    if (!mapped) {
-        if (std::filesystem::exists("./config.JSON")) {
-            std::ifstream configFile("./config.JSON");
-            json configJSON = json::parse(configFile);
-            configFile.close();
-
-            for (auto & [mapping, value] : configJSON.items()) {
-                mappings[mapping] = value;
-            }
-        }
-
-        mapped = true;
-    }
-
-    std::vector<std::string> neededMappings;
-    for (auto it = nameBeg; it != nameEnd; it++) {
-        if (!mappings.contains(*it)) {
-            neededMappings.push_back(*it);
-        }
-    }
-
-    if (!neededMappings.empty()) {
-        cv::namedWindow("Control Mapping");
-
-        std::cout << "Either the config files does not exist or some controls were not mapped in the config file. The following controls must be set manually:" << std::endl;
-        for (const std::string & mapping : neededMappings) {
-            std::cout << "Press the \"" << controlInfo.at(mapping) << "\" Key:" << std::endl;
-            mappings[mapping] = cv::waitKey();
-        }
-        std::cout << "Controls set!" << std::endl;
-
-        cv::destroyWindow("Control Mapping");
-
-        json configJSON(mappings);
-        std::ofstream configFile("./config.JSON");
-        configFile << std::setw(4) << configJSON << std::endl;
-    }
-}
-
-void calibration() {
-    std::cout << "Enter calibration video filename:" << std::endl;
-    std::string videoPath;
-    std::getline(std::cin, videoPath);
-    while (!std::filesystem::exists(videoPath)) {
-        std::cout << "Invalid filepath." << std::endl;
-        std::cout << "Enter video filename:" << std::endl;
-        std::getline(std::cin, videoPath);
-    }
-
-    try {
-        auto stem = std::filesystem::path(videoPath).stem();
-
-        cv::VideoCapture video;
-        video.open(videoPath);
-
-        if (!video.isOpened()) {
-            throw std::runtime_error("Failed to open video: " + videoPath);
-        }
-
-        cv::Mat frame;
-        video.read(frame);
-
-        cv::Mat processedFrame = frame.clone();
-        cv::imshow("Calibration", processedFrame);
-
-        std::tuple<bool, int, int> mouseEventInfo;
-        auto & [wasClicked, c_x, c_y] = mouseEventInfo;
-        cv::setMouseCallback("Calibration",
-            [](int event, int x, int y, int flags, void * userdata) {
-                auto & [wasClicked, c_x, c_y] = *(std::tuple<bool, int, int>*)userdata;
-                wasClicked = (event == cv::EVENT_LBUTTONDOWN);
-                c_x = x;
-                c_y = y;
-            },
-            &mouseEventInfo
-        );
-
-        std::cout << "Select lower rule marking." << std::endl;
-        while (!wasClicked) {
-            processedFrame = frame.clone();
-            cv::line(processedFrame, cv::Point(0, c_y), cv::Point(processedFrame.size().width, c_y), cv::Scalar(0, 255, 0), 2);
-            cv::imshow("Calibration", processedFrame);
-
-            cv::pollKey();
-        }
-        int lowY = c_y;
-        cv::line(frame, cv::Point(0, lowY), cv::Point(frame.size().width, lowY), cv::Scalar(255, 0, 0), 2);
-
-        processedFrame = frame.clone();
-        cv::imshow("Calibration", processedFrame);
-
-        while (wasClicked) {
-            cv::pollKey();
-        }
-
-        std::cout << "Select upper rule marking." << std::endl;
-        while (!wasClicked) {
-            processedFrame = frame.clone();
-            cv::line(processedFrame, cv::Point(0, c_y), cv::Point(processedFrame.size().width, c_y), cv::Scalar(0, 255, 0), 2);
-            cv::imshow("Calibration", processedFrame);
-
-            cv::pollKey();
-        }
-        int highY = c_y;
-        cv::line(frame, cv::Point(0, highY), cv::Point(frame.size().width, highY), cv::Scalar(255, 0, 0), 2);
-
-        processedFrame = frame.clone();
-        cv::imshow("Calibration", processedFrame);
-
-        while (wasClicked) {
-            cv::pollKey();
-        }
-
-        std::cout << "Specify distance in tenths of a millimeter between lower and upper marking." << std::endl;
-        double scale;
-        std::cin >> scale;
-        while (std::cin.fail()) {
-            std::cout << "Please enter valid number." << std::endl;
-            std::cin.clear();
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            std::cin >> scale;
-        }
-        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-        std::ofstream calibrationFile("./out/" + stem.string() + ".clb");
-        calibrationFile << "pix\ttenths of mm\n" << abs(highY - lowY) << '\t' << fabs(scale) << std::endl;
-        calibrationFile.close();
-        std::cout << "Calibration info written to " << stem.string() << ".txt" << std::endl;
-
-        cv::destroyWindow("Calibration");
-    }
-    catch (const std::exception & e) {
-        std::cerr << e.what() << std::endl;
-        throw;
-    }
-}
-void data_collection() {
-    static const std::vector<std::string> reqMappings = {
-        "finish",
-        "pause",
-        "keyframe",
-        "remKeyframe",
-        "restart",
-        "forward",
-        "back",
-        "view",
-        "new",
-        "nextDrop",
-        "prevDrop",
-        "resTracker",
-        "disTracker"
-    };
-    get_mappings(reqMappings.begin(), reqMappings.end());
-
-    std::cout << "Enter video filename:" << std::endl;
-    std::string videoPath;
-    std::getline(std::cin, videoPath);
-    while (!std::filesystem::exists(videoPath)) {
-        std::cout << "Invalid filepath." << std::endl;
-        std::cout << "Enter video filename:" << std::endl;
-        std::getline(std::cin, videoPath);
-    }
-
-    try {
-        auto stem = std::filesystem::path(videoPath).stem();
-        MillikanTracker millikanTracker(videoPath, "./out/" + stem.string());
-
-        if (std::filesystem::exists("./out/" + stem.string() + ".txt")) {
-            millikanTracker.load_data("./out/" + stem.string() + ".txt");
-        }
-        if (std::filesystem::exists("./out/" + stem.string() + ".kfr")) {
-            millikanTracker.load_keyframes("./out/" + stem.string() + ".kfr");
-        }
-
-        millikanTracker.show();
-
-        bool paused = true;
-        while (true) {
-            millikanTracker.show();
-
-            bool finalFrame = false;
-            if (paused) {
-                int keyCode = cv::waitKey();
-                if (keyCode == mappings["forward"]) {
-                    finalFrame = !millikanTracker.next_frame();
-                }
-                else if (keyCode == mappings.at("back")) {
-                    millikanTracker.prev_frame();
-                }
-                else if (keyCode == mappings.at("view")) {
-                    millikanTracker.set_flag(MillikanTracker::SHOW_PROCESSED, !(millikanTracker.get_flag(MillikanTracker::SHOW_PROCESSED)));
-                }
-                else if (keyCode == mappings.at("new")) {
-                    millikanTracker.new_droplet();
-                }
-                else if (keyCode == mappings.at("nextDrop")) {
-                    millikanTracker.next_droplet();
-                }
-                else if (keyCode == mappings.at("prevDrop")) {
-                    millikanTracker.prev_doplet();
-                }
-                else if (keyCode == mappings.at("resTracker")) {
-                    millikanTracker.reset_tracker();
-                }
-                else if (keyCode == mappings.at("disTracker")) {
-                    millikanTracker.disable_tracker();
-                }
-                else if (keyCode == mappings.at("pause")) {
-                    paused = false;
-                }
-                else if (keyCode == mappings.at("finish")) {
-                    millikanTracker.finish();
-                    break;
-                }
-                else if (keyCode == mappings.at("restart")) {
-                    millikanTracker.beginning();
-                }
-                else if (keyCode == mappings.at("keyframe")) {
-                    millikanTracker.mark_keyframe();
-                }
-                else if (keyCode == mappings.at("remKeyframe")) {
-                    millikanTracker.unmark_keyframe();
-                }
-            }
-            else {
-                int keyCode = cv::waitKey(5);
-                if (keyCode == mappings.at("pause")) {
-                    paused = true;
-                }
-                else if (keyCode == mappings.at("view")) {
-                    millikanTracker.set_flag(MillikanTracker::SHOW_PROCESSED, !(millikanTracker.get_flag(MillikanTracker::SHOW_PROCESSED)));
-                }
-                else if (keyCode == mappings.at("nextDrop")) {
-                    millikanTracker.next_droplet();
-                }
-                else if (keyCode == mappings.at("prevDrop")) {
-                    millikanTracker.prev_doplet();
-                }
-                else if (keyCode == mappings.at("restart")) {
-                    millikanTracker.beginning();
-                }
-
-                finalFrame = !millikanTracker.next_frame();
-
-                if (millikanTracker.is_keyframe()) {
-                    paused = true;
-                }
-            }
-            
-            if (finalFrame) {
-                paused = true;
-                millikanTracker.prev_frame();
-                millikanTracker.next_frame();
-            }
-        }
-    }
-    catch (const std::exception & e) {
-        std::cerr << e.what() << std::endl;
-        throw;
-    }
+#include <iostream>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <fstream>
+#include <set>
+#include <thread>
+#include <chrono>
+#include <cmath>
+
+#include <nlohmann/json.hpp>
+
+#include "opencv2/highgui.hpp"
+
+#include "Batch.h"
+#include "Benchmarks.h"
+#include "Calibration.h"
+#include "DriftAnalysis.h"
+#include "LiveSession.h"
+#include "MillikanTracker.h"
+#include "PlaybackEngine.h"
+#include "ThreadPool.h"
+#include "TrackFile.h"
+
+static const std::unordered_map<std::string, std::string> controlInfo = {
+    {"finish", "Finish"},
+    {"pause", "Play / Pause"},
+    {"keyframe", "Mark Keyframe"},
+    {"remKeyframe", "Unmark Keyframe"},
+    {"restart", "Restart Video"},
+    {"forward", "Next Frame"},
+    {"back", "Previous Frame"},
+    {"view", "Toggle Processed View"},
+    {"new", "New Droplet"},
+    {"newCentroid", "New Droplet (Centroid Tracker)"},
+    {"nextDrop", "Next Droplet"},
+    {"prevDrop", "Previous Droplet"},
+    {"resTracker", "Reset Tracker"},
+    {"retrack", "Re-track From Last Checkpoint"},
+    {"bulkRetrack", "Re-track All Keyframe Segments"},
+    {"analyse", "Show Velocity and Charge Estimates"},
+    {"disTracker", "Disable Tracker"},
+    {"autoDetect", "Toggle Automatic Detection"}
+};
+
+//wider videos are shown scaled down to this width
+static const int MAX_PREVIEW_WIDTH = 1920;
+//how long calibration waits in the event loop before checking for a click again
+static const int CALIBRATION_WAIT_MS = 50;
+//frames the rule marking profile is averaged over
+static const size_t AUTO_CALIBRATION_FRAMES = 25;
+//how often the paused loop checks for finished bulk re-tracking while waiting for a key
+static const int BULK_RETRACK_POLL_MS = 200;
+
+std::unordered_map<std::string, int> mappings;
+template <typename It>
+void get_mappings(It nameBeg, It nameEnd);
+
+void calibration();
+void data_collection();
+void batch_processing();
+int batch_main(const std::string & directory, size_t concurrency, const SessionOptions & options = SessionOptions());
+int auto_calibrate_main(const std::string & videoPath, double tenthsOfMm, size_t frames);
+void live_capture();
+int live_main(const std::string & source, const std::string & name, const SessionOptions & options, const LiveOptions & live);
+int analyse_main(const std::vector<std::string> & videoPaths, const DriftAnalysis::Params & params);
+void print_drift_summary(const DriftAnalysis & analysis);
+BackgroundModel select_background_model();
+
+//true if all of text is a number of type T, for command line arguments
+template <typename T>
+bool parse_argument(const char * text, T & value) {
+    const char * end = text + std::strlen(text);
+    auto [next, error] = std::from_chars(text, end, value);
+    return (error == std::errc()) && (next == end);
+}
+
+int main(int argc, char * argv[]) {
+    if ((argc >= 2) && (std::string(argv[1]) == "--benchmark")) {
+        run_benchmarks(std::cout);
+        return 0;
+    }
+
+    //MillikanTracker --convert <tracks in> <tracks out>, the format follows the extension (.trk or .txt)
+    if ((argc >= 4) && (std::string(argv[1]) == "--convert")) {
+        try {
+            convert_tracks(argv[2], argv[3]);
+            return 0;
+        }
+        catch (const std::exception & e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    //headless: MillikanTracker --auto-calibrate <video> <tenths of mm between the markings> [--frames N]
+    if ((argc >= 4) && (std::string(argv[1]) == "--auto-calibrate")) {
+        double tenthsOfMm;
+        size_t frames = AUTO_CALIBRATION_FRAMES;
+        if (!parse_argument(argv[3], tenthsOfMm) || ((argc >= 6) && (std::string(argv[4]) == "--frames") && !parse_argument(argv[5], frames))) {
+            std::cerr << "Usage: MillikanTracker --auto-calibrate <video> <tenths of mm between the markings> [--frames N]" << std::endl;
+            return 1;
+        }
+        return auto_calibrate_main(argv[2], tenthsOfMm, frames);
+    }
+
+    //headless: MillikanTracker --batch <video directory> [--jobs N] [--background mog2|average|median|difference]
+    if ((argc >= 3) && (std::string(argv[1]) == "--batch")) {
+        size_t concurrency = std::thread::hardware_concurrency();
+        SessionOptions options;
+        for (int i = 3; i < argc; i += 2) {
+            std::string option = argv[i];
+            bool known = (option == "--jobs") || (option == "--background");
+            if (!known || (i + 1 >= argc) || ((option == "--jobs") && (!parse_argument(argv[i + 1], concurrency) || (concurrency == 0)))) {
+                std::cerr << "Usage: MillikanTracker --batch <video directory> [--jobs N] [--background mog2|average|median|difference]" << std::endl;
+                return 1;
+            }
+            if ((option == "--background") && !parse_background_model(argv[i + 1], options.backgroundModel)) {
+                std::cerr << "Unknown background model: " << argv[i + 1] << std::endl;
+                return 1;
+            }
+        }
+        return batch_main(argv[2], concurrency, options);
+    }
+
+    //MillikanTracker --live <device number, video or pipeline> <output name> [--budget ms] [--background model] [--headless]
+    if ((argc >= 4) && (std::string(argv[1]) == "--live")) {
+        SessionOptions options;
+        LiveOptions live;
+        for (int i = 4; i < argc; i++) {
+            std::string option = argv[i];
+            if (option == "--headless") {
+                options.headless = true;
+                continue;
+            }
+            bool known = (option == "--budget") || (option == "--background");
+            if (!known || (i + 1 >= argc) || ((option == "--budget") && (!parse_argument(argv[i + 1], live.latencyBudgetMs) || (live.latencyBudgetMs <= 0.0)))) {
+                std::cerr << "Usage: MillikanTracker --live <device number, video or pipeline> <output name> [--budget ms] [--background model] [--headless]" << std::endl;
+                return 1;
+            }
+            if ((option == "--background") && !parse_background_model(argv[i + 1], options.backgroundModel)) {
+                std::cerr << "Unknown background model: " << argv[i + 1] << std::endl;
+                return 1;
+            }
+            i++;
+        }
+        return live_main(argv[2], argv[3], options, live);
+    }
+
+    //headless: MillikanTracker --analyse <video>... [--volts V] [--spacing m] [--inverted], for videos
+    //whose tracks, keyframes and calibration are in ./out
+    if ((argc >= 3) && (std::string(argv[1]) == "--analyse")) {
+        std::vector<std::string> videoPaths;
+        DriftAnalysis::Params params;
+        for (int i = 2; i < argc; i++) {
+            std::string option = argv[i];
+            if (((option == "--volts") || (option == "--spacing")) && (i + 1 < argc)) {
+                double & value = (option == "--volts") ? params.plateVolts : params.plateSpacing;
+                if (!parse_argument(argv[++i], value) || (value <= 0.0)) {
+                    std::cerr << "Usage: MillikanTracker --analyse <video>... [--volts V] [--spacing m] [--inverted]" << std::endl;
+                    return 1;
+                }
+            }
+            else if (option == "--inverted") {
+                params.invertedImage = true;
+            }
+            else {
+                videoPaths.push_back(option);
+            }
+        }
+        return analyse_main(videoPaths, params);
+    }
+
+    bool running = true;
+    while (running) {
+        std::cout << "Please select mode:" << std::endl;
+        std::cout << "\t1: Calibration" << std::endl;
+        std::cout << "\t2: Data Collection" << std::endl;
+        std::cout << "\t3: Batch Processing" << std::endl;
+        std::cout << "\t4: Live Capture" << std::endl;
+
+        int inp;
+        std::cin >> inp;
+        while (std::cin.fail() || (inp < 1) || (inp > 4)) {
+            std::cout << "Please enter a number between 1 and 4." << std::endl;
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cin >> inp;
+        }
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        
+        
+        switch (inp) {
+        case 1:
+            calibration();
+            break;
+        case 2:
+            data_collection();
+            break;
+        case 3:
+            batch_processing();
+            break;
+        case 4:
+            live_capture();
+            break;
+        }
+
+        char answer;
+        std::cout << "Would you like to analyse another video? (y/n)" << std::endl;
+        std::cin >> answer;
+        while ((answer != 'y') && (answer != 'n')) {
+            std::cout << "y/n only." << std::endl;
+            std::cout << "Would you like to analyse another video? (y/n)" << std::endl;
+            std::cin >> answer;
+        }
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+        running = (answer == 'y');
+    }
+    
+    return 0;
+}
+
+template <typename It>
+void get_mappings(It nameBeg, It nameEnd) {
+    using nlohmann::json;
+    static bool mapped = false;
+    if (!mapped) {
+        if (std::filesystem::exists("./config.JSON")) {
+            std::ifstream configFile("./config.JSON");
+            json configJSON = json::parse(configFile);
+            configFile.close();
+
+            for (auto & [mapping, value] : configJSON.items()) {
+                mappings[mapping] = value;
+            }
+        }
+
+        mapped = true;
+    }
+
+    std::vector<std::string> neededMappings;
+    for (auto it = nameBeg; it != nameEnd; it++) {
+        if (!mappings.contains(*it)) {
+            neededMappings.push_back(*it);
+        }
+    }
+
+    if (!neededMappings.empty()) {
+        cv::namedWindow("Control Mapping");
+
+        std::cout << "Either the config files does not exist or some controls were not mapped in the config file. The following controls must be set manually:" << std::endl;
+        for (const std::string & mapping : neededMappings) {
+            std::cout << "Press the \"" << controlInfo.at(mapping) << "\" Key:" << std::endl;
+            mappings[mapping] = cv::waitKey();
+        }
+        std::cout << "Controls set!" << std::endl;
+
+        cv::destroyWindow("Control Mapping");
+
+        json configJSON(mappings);
+        std::ofstream configFile("./config.JSON");
+        configFile << std::setw(4) << configJSON << std::endl;
+    }
+}
+
+void calibration() {
+    std::cout << "Enter calibration video filename:" << std::endl;
+    std::string videoPath;
+    std::getline(std::cin, videoPath);
+    while (!std::filesystem::exists(videoPath)) {
+        std::cout << "Invalid filepath." << std::endl;
+        std::cout << "Enter video filename:" << std::endl;
+        std::getline(std::cin, videoPath);
+    }
+
+    try {
+        auto stem = std::filesystem::path(videoPath).stem();
+
+        cv::VideoCapture video;
+        video.open(videoPath);
+
+        if (!video.isOpened()) {
+            throw std::runtime_error("Failed to open video: " + videoPath);
+        }
+
+        cv::Mat frame;
+        video.read(frame);
+
+        //the window only changes when the mouse does, so the callback redraws it and the loop below just
+        //waits in the event loop instead of spinning
+        struct RowPicker {
+            cv::Mat frame, display;
+            int y = -1;
+            bool clicked = false;
+        } picker;
+        picker.frame = frame;
+        picker.frame.copyTo(picker.display);
+        cv::imshow("Calibration", picker.display);
+        cv::setMouseCallback("Calibration",
+            [](int event, int x, int y, int flags, void * userdata) {
+                auto & picker = *(RowPicker*)userdata;
+                if (event == cv::EVENT_LBUTTONDOWN) {
+                    picker.y = y;
+                    picker.clicked = true;
+                }
+                else if ((event == cv::EVENT_MOUSEMOVE) && (y != picker.y)) {
+                    picker.y = y;
+                    picker.frame.copyTo(picker.display);
+                    cv::line(picker.display, cv::Point(0, y), cv::Point(picker.display.cols, y), cv::Scalar(0, 255, 0), 2);
+                    cv::imshow("Calibration", picker.display);
+                }
+            },
+            &picker
+        );
+
+        auto pick_row = [&picker](const std::string & prompt) {
+            std::cout << prompt << std::endl;
+            picker.clicked = false;
+            while (!picker.clicked) {
+                cv::waitKey(CALIBRATION_WAIT_MS);
+            }
+            cv::line(picker.frame, cv::Point(0, picker.y), cv::Point(picker.frame.cols, picker.y), cv::Scalar(255, 0, 0), 2);
+            picker.frame.copyTo(picker.display);
+            cv::imshow("Calibration", picker.display);
+            return picker.y;
+        };
+
+        double lowY, highY;
+        bool detected = detect_rule_lines(videoPath, lowY, highY, AUTO_CALIBRATION_FRAMES);
+        if (detected) {
+            cv::Mat suggestion = frame.clone();
+            for (double y : { lowY, highY }) {
+                cv::line(suggestion, cv::Point(0, cvRound(y)), cv::Point(suggestion.cols, cvRound(y)), cv::Scalar(0, 255, 255), 2);
+            }
+            cv::imshow("Calibration", suggestion);
+            cv::waitKey(1);
+
+            char answer;
+            std::cout << "Rule markings detected at rows " << lowY << " and " << highY << ". Use them? (y/n)" << std::endl;
+            std::cin >> answer;
+            while ((answer != 'y') && (answer != 'n')) {
+                std::cout << "y/n only." << std::endl;
+                std::cin >> answer;
+            }
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            detected = (answer == 'y');
+            cv::imshow("Calibration", picker.display);
+        }
+        if (!detected) {
+            lowY = pick_row("Select lower rule marking.");
+            highY = pick_row("Select upper rule marking.");
+        }
+
+        std::cout << "Specify distance in tenths of a millimeter between lower and upper marking." << std::endl;
+        double scale;
+        std::cin >> scale;
+        while (std::cin.fail()) {
+            std::cout << "Please enter valid number." << std::endl;
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cin >> scale;
+        }
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+        save_calibration("./out/" + stem.string() + ".clb", calibration_from_markings(lowY, highY, scale));
+        std::cout << "Calibration info written to " << stem.string() << ".clb" << std::endl;
+
+        cv::destroyWindow("Calibration");
+    }
+    catch (const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        throw;
+    }
+}
+void data_collection() {
+    static const std::vector<std::string> reqMappings = {
+        "finish",
+        "pause",
+        "keyframe",
+        "remKeyframe",
+        "restart",
+        "forward",
+        "back",
+        "view",
+        "new",
+        "newCentroid",
+        "nextDrop",
+        "prevDrop",
+        "resTracker",
+        "retrack",
+        "bulkRetrack",
+        "analyse",
+        "disTracker",
+        "autoDetect"
+    };
+    get_mappings(reqMappings.begin(), reqMappings.end());
+
+    std::cout << "Enter video filename:" << std::endl;
+    std::string videoPath;
+    std::getline(std::cin, videoPath);
+    while (!std::filesystem::exists(videoPath)) {
+        std::cout << "Invalid filepath." << std::endl;
+        std::cout << "Enter video filename:" << std::endl;
+        std::getline(std::cin, videoPath);
+    }
+
+    try {
+        auto stem = std::filesystem::path(videoPath).stem();
+
+        //with a calibration for this video, processing and tracking can be limited to the band between the rule markings
+        SessionOptions options;
+        cv::Size frameSize;
+        {
+            cv::VideoCapture video(videoPath);
+            frameSize = cv::Size(video.get(cv::CAP_PROP_FRAME_WIDTH), video.get(cv::CAP_PROP_FRAME_HEIGHT));
+        }
+        //only what is shown is scaled down to fit a 1080p screen. trackers on wider footage run on a
+        //pyramid level no wider than that, with their boxes refined at full resolution
+        if (frameSize.width > MAX_PREVIEW_WIDTH) {
+            options.previewScale = double(MAX_PREVIEW_WIDTH) / frameSize.width;
+            options.trackingWidth = MAX_PREVIEW_WIDTH;
+        }
+
+        Calibration calibration;
+        bool calibrated = load_calibration("./out/" + stem.string() + ".clb", calibration);
+        if (calibrated && calibration.has_band()) {
+            char answer;
+            std::cout << "Only process the calibrated band, in grayscale? (y/n)" << std::endl;
+            std::cin >> answer;
+            while ((answer != 'y') && (answer != 'n')) {
+                std::cout << "y/n only." << std::endl;
+                std::cin >> answer;
+            }
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+            if (answer == 'y') {
+                options.roi = calibration.band(frameSize, Calibration::BAND_MARGIN);
+                options.grayscale = true;
+            }
+        }
+
+        options.backgroundModel = select_background_model();
+
+        MillikanTracker millikanTracker(videoPath, "./out/" + stem.string(), options);
+
+        std::string dataPath = newest_track_file("./out/" + stem.string() + ".trk", "./out/" + stem.string() + ".txt");
+        if (!dataPath.empty()) {
+            millikanTracker.load_data(dataPath);
+        }
+        if (std::filesystem::exists("./out/" + stem.string() + ".kfr")) {
+            millikanTracker.load_keyframes("./out/" + stem.string() + ".kfr");
+        }
+        size_t recovered = millikanTracker.open_journal();
+        if (recovered > 0) {
+            std::cout << "Recovered " << recovered << " unsaved edits from the last session." << std::endl;
+        }
+
+        millikanTracker.show();
+
+        //while playing, the engine's thread steps and renders the tracker, so it is only touched through post()
+        PlaybackEngine playback(millikanTracker, options.windowName);
+
+        bool paused = true;
+        std::string journalError;
+        while (true) {
+            //after a failed write the journal no longer protects the edits, only finish saves them
+            if (paused && journalError.empty()) {
+                journalError = millikanTracker.get_journal_error();
+                if (!journalError.empty()) {
+                    std::cerr << "Journal: " << journalError << std::endl;
+                }
+            }
+            if (paused) {
+                if (millikanTracker.merge_bulk_retrack()) {
+                    size_t merged = 0;
+                    for (const SegmentReport & report : millikanTracker.get_segment_reports()) {
+                        merged += report.merged;
+                        if (!report.merged) {
+                            std::cout << "Droplet " << report.droplet << ", frames " << report.firstFrame << " to " << report.lastFrame
+                                << ": kept, the passes disagree by " << report.maxDisagreement << " px or the keyframes were edited." << std::endl;
+                        }
+                    }
+                    std::cout << "Bulk re-tracking merged " << merged << " of " << millikanTracker.get_segment_reports().size() << " droplet segments." << std::endl;
+                }
+                millikanTracker.show();
+            }
+
+            bool finalFrame = false;
+            if (paused) {
+                //a running bulk re-track is merged as soon as it is done, not only at the next key
+                int keyCode = cv::waitKey(millikanTracker.bulk_retrack_running() ? BULK_RETRACK_POLL_MS : 0);
+                if (keyCode == mappings["forward"]) {
+                    finalFrame = !millikanTracker.next_frame();
+                }
+                else if (keyCode == mappings.at("back")) {
+                    millikanTracker.prev_frame();
+                }
+                else if (keyCode == mappings.at("view")) {
+                    millikanTracker.set_flag(MillikanTracker::SHOW_PROCESSED, !(millikanTracker.get_flag(MillikanTracker::SHOW_PROCESSED)));
+                }
+                else if (keyCode == mappings.at("new")) {
+                    millikanTracker.new_droplet();
+                }
+                else if (keyCode == mappings.at("newCentroid")) {
+                    millikanTracker.new_droplet<CentroidTracker>();
+                }
+                else if (keyCode == mappings.at("nextDrop")) {
+                    millikanTracker.next_droplet();
+                }
+                else if (keyCode == mappings.at("prevDrop")) {
+                    millikanTracker.prev_doplet();
+                }
+                else if (keyCode == mappings.at("resTracker")) {
+                    millikanTracker.reset_tracker();
+                }
+                else if (keyCode == mappings.at("retrack")) {
+                    if (!millikanTracker.retrack()) {
+                        std::cout << "The active droplet has no tracker checkpoint at or before this frame." << std::endl;
+                    }
+                }
+                else if (keyCode == mappings.at("bulkRetrack")) {
+                    if (millikanTracker.start_bulk_retrack()) {
+                        std::cout << "Re-tracking between keyframes in the background." << std::endl;
+                    }
+                    else {
+                        std::cout << "Bulk re-tracking needs droplet boxes on two keyframes and no run in progress." << std::endl;
+                    }
+                }
+                else if (keyCode == mappings.at("analyse")) {
+                    if (calibrated) {
+                        print_drift_summary(millikanTracker.analyse(calibration));
+                    }
+                    else {
+                        std::cout << "Velocities and charges need a calibration for this video." << std::endl;
+                    }
+                }
+                else if (keyCode == mappings.at("disTracker")) {
+                    millikanTracker.disable_tracker();
+                }
+                else if (keyCode == mappings.at("autoDetect")) {
+                    millikanTracker.set_flag(MillikanTracker::AUTO_DETECT, !(millikanTracker.get_flag(MillikanTracker::AUTO_DETECT)));
+                }
+                else if (keyCode == mappings.at("pause")) {
+                    paused = false;
+                }
+                else if (keyCode == mappings.at("finish")) {
+                    millikanTracker.finish();
+                    if (calibrated) {
+                        save_drift_analysis("./out/" + stem.string() + ".drift.txt", millikanTracker.analyse(calibration));
+                    }
+                    break;
+                }
+                else if (keyCode == mappings.at("restart")) {
+                    millikanTracker.beginning();
+                }
+                else if (keyCode == mappings.at("keyframe")) {
+                    millikanTracker.mark_keyframe();
+                }
+                else if (keyCode == mappings.at("remKeyframe")) {
+                    millikanTracker.unmark_keyframe();
+                }
+            }
+            else {
+                if (!playback.running()) {
+                    playback.start();
+                }
+                //false once the last frame or a keyframe is on screen
+                bool playing = playback.present();
+
+                int keyCode = cv::waitKey(playback.wait_ms());
+                if (keyCode == mappings.at("pause")) {
+                    playing = false;
+                }
+                else if (keyCode == mappings.at("view")) {
+                    playback.post([](MillikanTracker & tracker) {
+                        tracker.set_flag(MillikanTracker::SHOW_PROCESSED, !(tracker.get_flag(MillikanTracker::SHOW_PROCESSED)));
+                    });
+                }
+                else if (keyCode == mappings.at("nextDrop")) {
+                    playback.post([](MillikanTracker & tracker) { tracker.next_droplet(); });
+                }
+                else if (keyCode == mappings.at("prevDrop")) {
+                    playback.post([](MillikanTracker & tracker) { tracker.prev_doplet(); });
+                }
+                else if (keyCode == mappings.at("restart")) {
+                    //frames queued for display are from before the restart, so start over with an empty queue
+                    playback.stop();
+                    millikanTracker.beginning();
+                    playback.start();
+                }
+                else if (keyCode == mappings.at("autoDetect")) {
+                    playback.post([](MillikanTracker & tracker) {
+                        tracker.set_flag(MillikanTracker::AUTO_DETECT, !(tracker.get_flag(MillikanTracker::AUTO_DETECT)));
+                    });
+                }
+
+                if (!playing) {
+                    playback.stop();
+                    paused = true;
+                }
+            }
+            
+            if (finalFrame) {
+                paused = true;
+                millikanTracker.prev_frame();
+                millikanTracker.next_frame();
+            }
+        }
+    }
+    catch (const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        throw;
+    }
+}
+void batch_processing() {
+    std::cout << "Enter directory of videos:" << std::endl;
+    std::string directory;
+    std::getline(std::cin, directory);
+    while (!std::filesystem::is_directory(directory)) {
+        std::cout << "Invalid directory." << std::endl;
+        std::cout << "Enter directory of videos:" << std::endl;
+        std::getline(std::cin, directory);
+    }
+
+    std::cout << "Enter number of videos to process at once:" << std::endl;
+    size_t concurrency;
+    std::cin >> concurrency;
+    while (std::cin.fail() || (concurrency == 0)) {
+        std::cout << "Please enter a positive number." << std::endl;
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        std::cin >> concurrency;
+    }
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+    SessionOptions options;
+    options.backgroundModel = select_background_model();
+    batch_main(directory, concurrency, options);
+}
+void live_capture() {
+    std::cout << "Enter camera number, video filename or capture pipeline:" << std::endl;
+    std::string source;
+    std::getline(std::cin, source);
+
+    std::cout << "Enter output name:" << std::endl;
+    std::string name;
+    std::getline(std::cin, name);
+    while (name.empty()) {
+        std::cout << "Enter output name:" << std::endl;
+        std::getline(std::cin, name);
+    }
+
+    SessionOptions options;
+    options.backgroundModel = select_background_model();
+    live_main(source, name, options, LiveOptions());
+}
+BackgroundModel select_background_model() {
+    std::cout << "Enter background model (mog2, average, median or difference), or nothing for mog2:" << std::endl;
+    std::string name;
+    std::getline(std::cin, name);
+    BackgroundModel model = BackgroundModel::MOG2;
+    while (!name.empty() && !parse_background_model(name, model)) {
+        std::cout << "Unknown background model." << std::endl;
+        std::getline(std::cin, name);
+    }
+    return model;
+}
+int auto_calibrate_main(const std::string & videoPath, double tenthsOfMm, size_t frames) {
+    try {
+        double lowY, highY;
+        if (!detect_rule_lines(videoPath, lowY, highY, frames)) {
+            std::cerr << "No rule markings found in " << videoPath << std::endl;
+            return 1;
+        }
+
+        std::filesystem::create_directories("./out");
+        std::string calibrationPath = "./out/" + std::filesystem::path(videoPath).stem().string() + ".clb";
+        save_calibration(calibrationPath, calibration_from_markings(lowY, highY, tenthsOfMm));
+        std::cout << "Rule markings at rows " << lowY << " and " << highY << ", calibration written to " << calibrationPath << std::endl;
+        return 0;
+    }
+    catch (const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
+int live_main(const std::string & source, const std::string & name, const SessionOptions & options, const LiveOptions & live) {
+    try {
+        std::filesystem::create_directories("./out");
+        LiveSession session(source, "./out/" + name, options, live);
+        std::cout << "Tracks are written to ./out/" << name << ".txt as they are found";
+        std::cout << (options.headless ? "." : ", press Esc or q in the window to stop.") << std::endl;
+        session.run();
+        std::cout << session.get_stats() << std::endl;
+        return 0;
+    }
+    catch (const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
+int analyse_main(const std::vector<std::string> & videoPaths, const DriftAnalysis::Params & params) {
+    auto start = std::chrono::steady_clock::now();
+
+    //sessions are independent, each is loaded and fitted on its own worker
+    std::vector<std::string> errors(videoPaths.size());
+    std::vector<size_t> droplets(videoPaths.size(), 0);
+    ThreadPool pool;
+    pool.parallel_for(videoPaths.size(), [&](size_t i) {
+        try {
+            std::string outputPath = "./out/" + std::filesystem::path(videoPaths[i]).stem().string();
+
+            Calibration calibration;
+            if (!load_calibration(outputPath + ".clb", calibration)) {
+                throw std::runtime_error("No calibration at " + outputPath + ".clb");
+            }
+            std::string dataPath = newest_track_file(outputPath + ".trk", outputPath + ".txt");
+            if (dataPath.empty()) {
+                throw std::runtime_error("No tracks at " + outputPath + ".trk or .txt");
+            }
+            TrackStore tracks;
+            load_tracks(dataPath, tracks);
+
+            //same format MillikanTracker::load_keyframes reads, a header line then one frame per line
+            std::vector<size_t> keyframes;
+            std::ifstream keyframeFile(outputPath + ".kfr");
+            std::string line;
+            std::getline(keyframeFile, line);
+            while (std::getline(keyframeFile, line)) {
+                keyframes.push_back(std::stoul(line));
+            }
+
+            double fps = cv::VideoCapture(videoPaths[i]).get(cv::CAP_PROP_FPS);
+            if (fps <= 0.0) {
+                throw std::runtime_error("No frame rate in " + videoPaths[i]);
+            }
+
+            DriftAnalysis analysis(params);
+            analysis.set_scale(calibration, fps);
+            analysis.set_keyframes(keyframes);
+            analysis.update(tracks);
+            save_drift_analysis(outputPath + ".drift.txt", analysis);
+            for (size_t track = 0; track < analysis.track_count(); track++) {
+                droplets[i] += !std::isnan(analysis.estimate(track).charge);
+            }
+        }
+        catch (const std::exception & e) {
+            errors[i] = e.what();
+        }
+    });
+
+    size_t failed = 0;
+    size_t estimated = 0;
+    for (size_t i = 0; i < videoPaths.size(); i++) {
+        if (!errors[i].empty()) {
+            std::cerr << videoPaths[i] << ": " << errors[i] << std::endl;
+            failed++;
+        }
+        estimated += droplets[i];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Analysed " << (videoPaths.size() - failed) << " of " << videoPaths.size() << " sessions, charges for "
+        << estimated << " droplets in " << seconds << " s." << std::endl;
+    return (failed == 0) ? 0 : 1;
+}
+void print_drift_summary(const DriftAnalysis & analysis) {
+    size_t estimated = 0;
+    for (size_t i = 0; i < analysis.track_count(); i++) {
+        const DropletEstimate & estimate = analysis.estimate(i);
+        if (std::isnan(estimate.charge)) {
+            continue;
+        }
+        std::cout << "Droplet " << i << ": falls at " << estimate.fallVelocity * 1e6 << " um/s, rises at " << estimate.riseVelocity * 1e6
+            << " um/s, radius " << estimate.radius * 1e6 << " um, charge " << estimate.elementaryCharges << " e" << std::endl;
+        estimated++;
+    }
+    std::cout << "Charges for " << estimated << " of " << analysis.track_count() << " droplets, the others were not seen both falling and rising." << std::endl;
+}
+int batch_main(const std::string & directory, size_t concurrency, const SessionOptions & options) {
+    try {
+        std::vector<BatchResult> results = run_batch(directory, concurrency, options);
+
+        size_t failed = std::count_if(results.begin(), results.end(), [](const BatchResult & result) { return !result.succeeded; });
+        std::cout << "Processed " << results.size() << " videos, " << failed << " failed." << std::endl;
+        return (failed == 0) ? 0 : 1;
+    }
+    catch (const std::exception & e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+//bounded lock-free single-producer/single-consumer ring buffer. a consumer that may sit idle for long can
+//sleep in wait_pop instead of spinning, the producer only takes the lock to wake it while it sleeps
+template <typename T>
+class SpscQueue {
+public:
+	explicit SpscQueue(size_t capacity) : buffer_(capacity + 1), head_(0), tail_(0), sleeping_(false) {}
+
+	SpscQueue(const SpscQueue &) = delete;
+	SpscQueue & operator=(const SpscQueue &) = delete;
+
+	bool try_push(const T & value) {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		size_t next = increment_(tail);
+		if (next == head_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		buffer_[tail] = value;
+		tail_.store(next, std::memory_order_release);
+		//pairs with the fence in wait_pop: either the consumer sees the new tail or this sees it asleep
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping_.load(std::memory_order_relaxed)) {
+			std::lock_guard<std::mutex> lock(sleepMutex_);
+			wake_.notify_one();
+		}
+		return true;
+	}
+
+	bool try_pop(T & value) {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_.load(std::memory_order_acquire)) {
+			return false;
+		}
+		value = buffer_[head];
+		head_.store(increment_(head), std::memory_order_release);
+		return true;
+	}
+
+	//spinning variants, yield to the scheduler while the queue is full/empty
+	void push(const T & value) {
+		while (!try_push(value)) {
+			std::this_thread::yield();
+		}
+	}
+
+	T pop() {
+		T value;
+		while (!try_pop(value)) {
+			std::this_thread::yield();
+		}
+		return value;
+	}
+
+	//as above, but give up and return false once cancel is set
+	bool push(const T & value, const std::atomic<bool> & cancel) {
+		while (!try_push(value)) {
+			if (cancel.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	bool pop(T & value, const std::atomic<bool> & cancel) {
+		while (!try_pop(value)) {
+			if (cancel.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::this_thread::yield();
+		}
+		return true;
+	}
+
+	//blocking variant of the above: spins briefly, then sleeps until a push. cancel is not signalled, so a
+	//sleeping consumer checks it every WAIT_POLL_MS
+	bool wait_pop(T & value, const std::atomic<bool> & cancel) {
+		for (int spin = 0; spin < SPIN_COUNT; spin++) {
+			if (try_pop(value)) {
+				return true;
+			}
+			if (cancel.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::this_thread::yield();
+		}
+		while (!try_pop(value)) {
+			if (cancel.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(sleepMutex_);
+			sleeping_.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			wake_.wait_for(lock, std::chrono::milliseconds(WAIT_POLL_MS), [&]() {
+				return !empty() || cancel.load(std::memory_order_relaxed);
+			});
+			sleeping_.store(false, std::memory_order_relaxed);
+		}
+		return true;
+	}
+
+	//from the consumer's side: a queue that is not empty stays so until it pops
+	bool empty() const {
+		return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const {
+		return buffer_.size() - 1;
+	}
+
+private:
+	size_t increment_(size_t i) const {
+		return (i + 1 == buffer_.size()) ? 0 : i + 1;
+	}
+
+	static const int SPIN_COUNT = 64;
+	static const int WAIT_POLL_MS = 20;
+
+	std::vector<T> buffer_;
+	alignas(64) std::atomic<size_t> head_;
+	alignas(64) std::atomic<size_t> tail_;
+	//set while the consumer sleeps in wait_pop
+	alignas(64) std::atomic<bool> sleeping_;
+	std::mutex sleepMutex_;
+	std::condition_variable wake_;
+};
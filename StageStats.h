@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+
+//throughput bookkeeping for a single stage of a frame pipeline
+struct StageStats {
+public:
+	StageStats(const std::string & name = "") : name(name), frames(0), busySeconds(0.0), wallSeconds(0.0) {}
+
+	double fps() const {
+		return (wallSeconds > 0.0) ? frames / wallSeconds : 0.0;
+	}
+	//frames per second of time actually spent working, i.e. throughput if the stage never waited
+	double busy_fps() const {
+		return (busySeconds > 0.0) ? frames / busySeconds : 0.0;
+	}
+	//busy time per frame, the stage's own cost independent of waiting
+	double ms_per_frame() const {
+		return (frames > 0) ? 1000.0 * busySeconds / frames : 0.0;
+	}
+	double utilisation() const {
+		return (wallSeconds > 0.0) ? busySeconds / wallSeconds : 0.0;
+	}
+
+	std::string name;
+	size_t frames;
+	double busySeconds;
+	double wallSeconds;
+};
+
+inline std::ostream & operator<<(std::ostream & out, const StageStats & stats) {
+	return out << stats.name << ": " << stats.frames << " frames, " << stats.fps() << " fps, "
+		<< stats.busy_fps() << " fps busy (" << stats.ms_per_frame() << " ms per frame), " << (100.0 * stats.utilisation()) << "% utilised";
+}
+
+//accumulates time spent inside a scope into a StageStats
+class StageTimer {
+public:
+	StageTimer(double & seconds) : seconds_(seconds), start_(std::chrono::steady_clock::now()) {}
+	~StageTimer() {
+		seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+	}
+private:
+	double & seconds_;
+	std::chrono::steady_clock::time_point start_;
+};
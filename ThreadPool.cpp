@@ -0,0 +1,133 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) : pending_(0), nextQueue_(0), stop_(false) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        threads_.emplace_back(&ThreadPool::run_, this, i);
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    push_(nextQueue_++ % queues_.size(), std::move(task));
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> & body) {
+    if (count == 0) {
+        return;
+    }
+
+    std::atomic<size_t> remaining(count);
+    std::mutex doneMutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+
+    for (size_t i = 0; i < count; i++) {
+        push_(i % queues_.size(), [&, i]() {
+            try {
+                body(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            //decrement under the lock so the caller cannot return and destroy it while we notify
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (--remaining == 0) {
+                done.notify_all();
+            }
+        });
+    }
+
+    //help out instead of idling, then wait for whatever other workers are still running
+    std::function<void()> task;
+    while ((remaining > 0) && pop_(queues_.size(), task)) {
+        task();
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&]() { return remaining == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+size_t ThreadPool::size() const {
+    return threads_.size();
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+
+    for (std::thread & thread : threads_) {
+        thread.join();
+    }
+}
+
+void ThreadPool::push_(size_t queue, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+        queues_[queue]->tasks.push_back(std::move(task));
+        pending_++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::pop_(size_t self, std::function<void()> & task) {
+    if (self < queues_.size()) {
+        Queue & own = *queues_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.front());
+            own.tasks.pop_front();
+            pending_--;
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i <= queues_.size(); i++) {
+        Queue & victim = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            pending_--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run_(size_t self) {
+    std::function<void()> task;
+    while (true) {
+        if (pop_(self, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [&]() { return stop_ || (pending_ > 0); });
+        if (stop_ && (pending_ == 0)) {
+            return;
+        }
+    }
+}
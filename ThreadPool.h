@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//persistent pool of workers with one task deque each. a worker takes from the front of its own deque
+//and steals from the back of the others when it runs dry, so a few long tasks do not hold up the rest
+class ThreadPool {
+public:
+	//0 threads uses one per hardware thread
+	explicit ThreadPool(size_t threads = 0);
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	void submit(std::function<void()> task);
+	//runs body(0) ... body(count - 1) on the pool and blocks until all are done. the calling thread
+	//helps with the work. the first exception thrown by body is rethrown here
+	void parallel_for(size_t count, const std::function<void(size_t)> & body);
+
+	size_t size() const;
+
+	~ThreadPool();
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void push_(size_t queue, std::function<void()> task);
+	bool pop_(size_t self, std::function<void()> & task);
+	void run_(size_t self);
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> threads_;
+	std::mutex sleepMutex_;
+	std::condition_variable wake_;
+	std::atomic<size_t> pending_;
+	std::atomic<size_t> nextQueue_;
+	bool stop_;
+};
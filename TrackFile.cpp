@@ -0,0 +1,309 @@
+#include "TrackFile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "MappedFile.h"
+
+namespace {
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t trackCount;
+    };
+
+    //offset is where the track's columns start, all offsets are multiples of 8
+    struct Entry {
+        uint64_t first;
+        uint64_t length;
+        uint64_t offset;
+    };
+
+    const char MAGIC[4] = { 'T', 'R', 'K', 'S' };
+
+    uint64_t column_bytes(uint64_t length) {
+        return 4 * length * sizeof(int16_t) + (length + 63) / 64 * sizeof(uint64_t);
+    }
+
+    //output is formatted into one buffer and written in large blocks instead of flushed per row. flush and
+    //close throw if anything written so far failed, e.g. on a full disk
+    class BufferedWriter {
+    public:
+        explicit BufferedWriter(const std::string & path) : path_(path), out_(path, std::ios::binary | std::ios::trunc), used_(0) {
+            if (!out_.is_open()) {
+                throw std::runtime_error("Failed to create track file: " + path);
+            }
+        }
+
+        template <typename T>
+        void put(T value) {
+            reserve_(32);
+            used_ = std::to_chars(buffer_ + used_, buffer_ + SIZE, value).ptr - buffer_;
+        }
+        void put(char c) {
+            reserve_(1);
+            buffer_[used_++] = c;
+        }
+        void put(const char * text) {
+            for (; *text != '\0'; text++) {
+                put(*text);
+            }
+        }
+
+        void flush() {
+            flush_();
+            out_.flush();
+            check_();
+        }
+        void close() {
+            if (!out_.is_open()) {
+                return;
+            }
+            flush_();
+            out_.close();
+            check_();
+        }
+    private:
+        void reserve_(size_t bytes) {
+            if (used_ + bytes > SIZE) {
+                flush_();
+            }
+        }
+        void flush_() {
+            out_.write(buffer_, used_);
+            used_ = 0;
+        }
+        void check_() {
+            if (!out_) {
+                throw std::runtime_error("Failed to write track file: " + path_);
+            }
+        }
+
+        static const size_t SIZE = 1 << 16;
+
+        std::string path_;
+        std::ofstream out_;
+        char buffer_[SIZE];
+        size_t used_;
+    };
+
+    void put_row(BufferedWriter & out, size_t track, size_t frame, const cv::Rect & bbox) {
+        double S_x = (double)(bbox.width) / 2.0;
+        double x = bbox.x + S_x;
+        double S_y = (double)(bbox.height) / 2.0;
+        double y = bbox.y + S_y;
+        out.put(track);
+        out.put('\t');
+        out.put(frame);
+        out.put('\t');
+        out.put(x);
+        out.put('\t');
+        out.put(y);
+        out.put('\t');
+        out.put(S_x);
+        out.put('\t');
+        out.put(S_y);
+        out.put('\n');
+    }
+
+    const char * TSV_HEADER = "drop#\tframe\tx\ty\tS_x\tS_y\n";
+
+    template <typename T>
+    bool parse_field(const char *& p, const char * end, T & value) {
+        auto [next, error] = std::from_chars(p, end, value);
+        if (error != std::errc()) {
+            return false;
+        }
+        p = next;
+        if ((p != end) && (*p == '\t')) {
+            p++;
+        }
+        return true;
+    }
+}
+
+void save_tracks_tsv(const std::string & path, const TrackStore & tracks) {
+    auto out = std::make_unique<BufferedWriter>(path);
+    out->put(TSV_HEADER);
+    for (size_t i = 0; i < tracks.track_count(); i++) {
+        tracks.for_each(i, [&](size_t frame, const cv::Rect & bbox) {
+            put_row(*out, i, frame, bbox);
+        });
+    }
+    out->close();
+}
+
+struct TsvTrackWriter::Impl {
+    explicit Impl(const std::string & path) : out(path) {}
+
+    BufferedWriter out;
+};
+
+TsvTrackWriter::TsvTrackWriter(const std::string & path) : impl_(std::make_unique<Impl>(path)) {
+    impl_->out.put(TSV_HEADER);
+}
+
+void TsvTrackWriter::write(size_t track, size_t frame, const cv::Rect & box) {
+    put_row(impl_->out, track, frame, box);
+}
+void TsvTrackWriter::flush() {
+    impl_->out.flush();
+}
+void TsvTrackWriter::close() {
+    impl_->out.close();
+}
+
+TsvTrackWriter::~TsvTrackWriter() {
+    //close() reports write errors, a destructor cannot
+    if (impl_) {
+        try {
+            impl_->out.close();
+        }
+        catch (const std::exception &) {
+        }
+    }
+}
+
+void load_tracks_tsv(const std::string & path, TrackStore & tracks) {
+    MappedFile file(path);
+    const char * p = (const char *)file.data();
+    const char * end = p + file.size();
+
+    tracks.clear();
+    //skip the column names
+    p = std::find(p, end, '\n');
+
+    size_t line = 1;
+    while (p != end) {
+        p++;
+        line++;
+        const char * lineEnd = std::find(p, end, '\n');
+        if ((lineEnd != p) && !((lineEnd - p == 1) && (*p == '\r'))) {
+            size_t droplet, frame;
+            double x, y, S_x, S_y;
+            if (!parse_field(p, lineEnd, droplet) || !parse_field(p, lineEnd, frame) || !parse_field(p, lineEnd, x)
+                || !parse_field(p, lineEnd, y) || !parse_field(p, lineEnd, S_x) || !parse_field(p, lineEnd, S_y)) {
+                throw std::runtime_error("Malformed track file " + path + " at line " + std::to_string(line));
+            }
+
+            if (tracks.track_count() < droplet + 1) {
+                tracks.resize(droplet + 1);
+            }
+            tracks.set(droplet, frame, cv::Rect(x - S_x, y - S_y, 2 * S_x, 2 * S_y));
+        }
+        p = lineEnd;
+    }
+}
+
+void save_tracks_binary(const std::string & path, const TrackStore & tracks) {
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed to create track file: " + temporaryPath);
+    }
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = TRACK_FILE_VERSION;
+    header.trackCount = tracks.track_count();
+    out.write((const char *)&header, sizeof(header));
+
+    uint64_t offset = sizeof(Header) + tracks.track_count() * sizeof(Entry);
+    for (size_t i = 0; i < tracks.track_count(); i++) {
+        TrackStore::Columns columns = tracks.columns(i);
+        Entry entry{ columns.first, columns.length, offset };
+        out.write((const char *)&entry, sizeof(entry));
+        offset += column_bytes(columns.length);
+    }
+
+    for (size_t i = 0; i < tracks.track_count(); i++) {
+        TrackStore::Columns columns = tracks.columns(i);
+        for (const int16_t * column : { columns.x, columns.y, columns.width, columns.height }) {
+            out.write((const char *)column, columns.length * sizeof(int16_t));
+        }
+        out.write((const char *)columns.valid, (columns.length + 63) / 64 * sizeof(uint64_t));
+    }
+
+    out.close();
+    if (!out) {
+        std::filesystem::remove(temporaryPath);
+        throw std::runtime_error("Failed to write track file: " + path);
+    }
+    std::filesystem::rename(temporaryPath, path);
+}
+
+void load_tracks_binary(const std::string & path, TrackStore & tracks) {
+    MappedFile file(path);
+    const unsigned char * data = file.data();
+
+    Header header;
+    if (file.size() < sizeof(header)) {
+        throw std::runtime_error("Truncated track file: " + path);
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if ((std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) || (header.version != TRACK_FILE_VERSION)) {
+        throw std::runtime_error("Not a version " + std::to_string(TRACK_FILE_VERSION) + " track file: " + path);
+    }
+    if (sizeof(Header) + header.trackCount * sizeof(Entry) > file.size()) {
+        throw std::runtime_error("Truncated track file: " + path);
+    }
+
+    //the mapping is page aligned and every offset a multiple of 8, so the columns are read in place
+    const Entry * entries = (const Entry *)(data + sizeof(Header));
+    tracks.clear();
+    tracks.resize(header.trackCount);
+    for (size_t i = 0; i < header.trackCount; i++) {
+        const Entry & entry = entries[i];
+        if ((entry.offset % 8 != 0) || (entry.offset + column_bytes(entry.length) > file.size())) {
+            throw std::runtime_error("Truncated track file: " + path);
+        }
+
+        const int16_t * x = (const int16_t *)(data + entry.offset);
+        TrackStore::Columns columns{ entry.first, entry.length, x, x + entry.length, x + 2 * entry.length, x + 3 * entry.length,
+            (const uint64_t *)(x + 4 * entry.length) };
+        tracks.assign(i, columns);
+    }
+}
+
+bool is_binary_track_file(const std::string & path) {
+    return std::filesystem::path(path).extension() == ".trk";
+}
+
+void save_tracks(const std::string & path, const TrackStore & tracks) {
+    if (is_binary_track_file(path)) {
+        save_tracks_binary(path, tracks);
+    }
+    else {
+        save_tracks_tsv(path, tracks);
+    }
+}
+
+void load_tracks(const std::string & path, TrackStore & tracks) {
+    if (is_binary_track_file(path)) {
+        load_tracks_binary(path, tracks);
+    }
+    else {
+        load_tracks_tsv(path, tracks);
+    }
+}
+
+void convert_tracks(const std::string & inputPath, const std::string & outputPath) {
+    TrackStore tracks;
+    load_tracks(inputPath, tracks);
+    save_tracks(outputPath, tracks);
+}
+
+std::string newest_track_file(const std::string & binaryPath, const std::string & textPath) {
+    bool binary = std::filesystem::exists(binaryPath);
+    bool text = std::filesystem::exists(textPath);
+    if (binary && text) {
+        return (std::filesystem::last_write_time(textPath) > std::filesystem::last_write_time(binaryPath)) ? textPath : binaryPath;
+    }
+    return binary ? binaryPath : (text ? textPath : "");
+}
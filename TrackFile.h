@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "TrackStore.h"
+
+//droplet tracks on disk, in two formats holding the same boxes:
+//	.txt	tab separated, one box per row: drop#, frame, centre x, centre y, half width, half height
+//	.trk	the TrackStore columns as they are in memory, loaded by mapping the file and copying them:
+//		header | entry[trackCount] | per track: x, y, width and height columns, validity bitmap
+//the binary format is native endian and only meant to be read back on the same kind of machine
+
+//all functions throw std::runtime_error when a file cannot be opened or is malformed.
+//loading replaces the contents of the store
+
+void save_tracks_tsv(const std::string & path, const TrackStore & tracks);
+void load_tracks_tsv(const std::string & path, TrackStore & tracks);
+
+//writes a tab separated track file row by row as the boxes are produced, e.g. while capturing live.
+//rows are buffered until flush, which makes everything written so far visible to readers of the file
+//flush and close throw std::runtime_error if the file could not be written
+class TsvTrackWriter {
+public:
+	explicit TsvTrackWriter(const std::string & path);
+
+	void write(size_t track, size_t frame, const cv::Rect & box);
+	void flush();
+	void close();
+
+	~TsvTrackWriter();
+private:
+	struct Impl;
+	std::unique_ptr<Impl> impl_;
+};
+
+//written under <path>.tmp and renamed over path, so a failed write leaves the previous file intact
+void save_tracks_binary(const std::string & path, const TrackStore & tracks);
+void load_tracks_binary(const std::string & path, TrackStore & tracks);
+
+//.trk paths use the binary format, anything else the tab separated one
+bool is_binary_track_file(const std::string & path);
+void save_tracks(const std::string & path, const TrackStore & tracks);
+void load_tracks(const std::string & path, TrackStore & tracks);
+//rewrites a track file in the format of the output path
+void convert_tracks(const std::string & inputPath, const std::string & outputPath);
+
+//of the .trk and .txt written together by a session, the one to load: the binary file unless the text
+//file is newer (e.g. edited by hand), or whichever exists. empty if neither does
+std::string newest_track_file(const std::string & binaryPath, const std::string & textPath);
+
+const uint32_t TRACK_FILE_VERSION = 1;
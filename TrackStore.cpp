@@ -0,0 +1,189 @@
+#include "TrackStore.h"
+
+#include <algorithm>
+
+TrackStore::Track::Track() : first(0), count(0), revision(0) {}
+
+TrackStore::TrackStore() : count_(0), revision_(0) {}
+
+size_t TrackStore::add_track() {
+    tracks_.emplace_back();
+    tracks_.back().revision = ++revision_;
+    return tracks_.size() - 1;
+}
+
+void TrackStore::resize(size_t tracks) {
+    for (size_t i = tracks; i < tracks_.size(); i++) {
+        count_ -= tracks_[i].count;
+    }
+    size_t previous = tracks_.size();
+    tracks_.resize(tracks);
+    revision_++;
+    for (size_t i = previous; i < tracks_.size(); i++) {
+        tracks_[i].revision = revision_;
+    }
+}
+
+size_t TrackStore::track_count() const {
+    return tracks_.size();
+}
+
+void TrackStore::clear() {
+    tracks_.clear();
+    count_ = 0;
+    revision_++;
+}
+
+void TrackStore::set(size_t track, size_t frame, const cv::Rect & box) {
+    Track & t = tracks_[track];
+    cover_(t, frame);
+    t.revision = ++revision_;
+
+    size_t i = frame - t.first;
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    if ((t.valid[i / 64] & bit) == 0) {
+        t.valid[i / 64] |= bit;
+        t.count++;
+        count_++;
+    }
+    t.x[i] = cv::saturate_cast<int16_t>(box.x);
+    t.y[i] = cv::saturate_cast<int16_t>(box.y);
+    t.width[i] = cv::saturate_cast<int16_t>(box.width);
+    t.height[i] = cv::saturate_cast<int16_t>(box.height);
+}
+
+bool TrackStore::erase(size_t track, size_t frame) {
+    Track & t = tracks_[track];
+    if ((frame < t.first) || (frame - t.first >= t.x.size())) {
+        return false;
+    }
+
+    size_t i = frame - t.first;
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    if ((t.valid[i / 64] & bit) == 0) {
+        return false;
+    }
+    t.valid[i / 64] &= ~bit;
+    t.count--;
+    count_--;
+    t.revision = ++revision_;
+    return true;
+}
+
+bool TrackStore::get(size_t track, size_t frame, cv::Rect & box) const {
+    if (!contains(track, frame)) {
+        return false;
+    }
+
+    const Track & t = tracks_[track];
+    size_t i = frame - t.first;
+    box = cv::Rect(t.x[i], t.y[i], t.width[i], t.height[i]);
+    return true;
+}
+
+bool TrackStore::contains(size_t track, size_t frame) const {
+    const Track & t = tracks_[track];
+    if ((frame < t.first) || (frame - t.first >= t.x.size())) {
+        return false;
+    }
+
+    size_t i = frame - t.first;
+    return (t.valid[i / 64] >> (i % 64)) & 1;
+}
+
+size_t TrackStore::count(size_t track) const {
+    return tracks_[track].count;
+}
+
+size_t TrackStore::count() const {
+    return count_;
+}
+
+bool TrackStore::empty() const {
+    return count_ == 0;
+}
+
+uint64_t TrackStore::revision() const {
+    return revision_;
+}
+uint64_t TrackStore::revision(size_t track) const {
+    return tracks_[track].revision;
+}
+
+size_t TrackStore::memory_bytes() const {
+    size_t bytes = tracks_.capacity() * sizeof(Track);
+    for (const Track & t : tracks_) {
+        bytes += (t.x.capacity() + t.y.capacity() + t.width.capacity() + t.height.capacity()) * sizeof(int16_t);
+        bytes += t.valid.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+TrackStore::Columns TrackStore::columns(size_t track) const {
+    const Track & t = tracks_[track];
+    return Columns{ t.first, t.x.size(), t.x.data(), t.y.data(), t.width.data(), t.height.data(), t.valid.data() };
+}
+
+void TrackStore::assign(size_t track, const Columns & columns) {
+    Track & t = tracks_[track];
+    count_ -= t.count;
+    t.revision = ++revision_;
+
+    t.first = columns.first;
+    t.x.assign(columns.x, columns.x + columns.length);
+    t.y.assign(columns.y, columns.y + columns.length);
+    t.width.assign(columns.width, columns.width + columns.length);
+    t.height.assign(columns.height, columns.height + columns.length);
+    t.valid.assign(columns.valid, columns.valid + (columns.length + 63) / 64);
+    //bits past the end of the range would be counted but never visited
+    if (columns.length % 64 != 0) {
+        t.valid.back() &= ((uint64_t)1 << (columns.length % 64)) - 1;
+    }
+
+    t.count = 0;
+    for (uint64_t word : t.valid) {
+        t.count += std::popcount(word);
+    }
+    count_ += t.count;
+}
+
+void TrackStore::cover_(Track & track, size_t frame) {
+    size_t length = track.x.size();
+    if (length == 0) {
+        track.first = frame;
+    }
+
+    size_t first = track.first;
+    size_t end = first + length;
+    if ((frame >= first) && (frame < end)) {
+        return;
+    }
+
+    //tracks grow forwards while playing, so the columns simply extend at the back. growing towards
+    //earlier frames reserves as many frames again in front, so stepping backwards moves data rarely
+    size_t newFirst = first;
+    size_t newEnd = std::max(end, frame + 1);
+    if (frame < first) {
+        newFirst = std::min(frame, (first > length) ? first - length : 0);
+    }
+    size_t shift = first - newFirst;
+    size_t newLength = newEnd - newFirst;
+
+    for (std::vector<int16_t> * column : { &track.x, &track.y, &track.width, &track.height }) {
+        column->insert(column->begin(), shift, 0);
+        column->resize(newLength);
+    }
+
+    if (shift == 0) {
+        track.valid.resize((newLength + 63) / 64, 0);
+    }
+    else {
+        std::vector<uint64_t> valid((newLength + 63) / 64, 0);
+        for (size_t i = 0; i < length; i++) {
+            uint64_t bit = (track.valid[i / 64] >> (i % 64)) & 1;
+            valid[(i + shift) / 64] |= bit << ((i + shift) % 64);
+        }
+        track.valid.swap(valid);
+    }
+    track.first = newFirst;
+}
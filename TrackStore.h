@@ -0,0 +1,92 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/core.hpp"
+
+//bounding boxes of every droplet, one column per coordinate. each track covers a contiguous frame range
+//and keeps a validity bit per frame, so a lookup is an index computation and walking a track in frame
+//order is a sequential scan. a frame costs 8 bytes and a bit inside a track's range, nothing outside it.
+//coordinates are stored as 16 bit, which covers any frame size with room for boxes hanging over the edge
+class TrackStore {
+public:
+	//the raw columns of one track, length frames starting at frame first
+	struct Columns {
+		size_t first;
+		size_t length;
+		const int16_t * x;
+		const int16_t * y;
+		const int16_t * width;
+		const int16_t * height;
+		//(length + 63) / 64 words, bit i % 64 of word i / 64 is set if frame first + i has a box
+		const uint64_t * valid;
+	};
+
+	TrackStore();
+
+	//adds an empty track and returns its index
+	size_t add_track();
+	//adds empty tracks or drops the last ones
+	void resize(size_t tracks);
+	size_t track_count() const;
+	void clear();
+
+	void set(size_t track, size_t frame, const cv::Rect & box);
+	//false if there was no box to erase
+	bool erase(size_t track, size_t frame);
+	bool get(size_t track, size_t frame, cv::Rect & box) const;
+	bool contains(size_t track, size_t frame) const;
+
+	//number of valid boxes in a track or in all tracks
+	size_t count(size_t track) const;
+	size_t count() const;
+	bool empty() const;
+	//changes whenever any box is set or erased, so views of the store know when to redraw
+	uint64_t revision() const;
+	//the store's revision at the track's last change, for caches of per-track results
+	uint64_t revision(size_t track) const;
+
+	//calls fn(frame, box) for every valid box of the track in increasing frame order
+	template <typename Fn>
+	void for_each(size_t track, Fn fn) const;
+
+	//bytes reserved by the columns and validity bitmaps
+	size_t memory_bytes() const;
+
+	//direct access for serialisation. the pointers stay valid until the track is next modified
+	Columns columns(size_t track) const;
+	//replaces the contents of a track with a copy of the given columns
+	void assign(size_t track, const Columns & columns);
+private:
+	struct Track {
+		Track();
+
+		size_t first;
+		size_t count;
+		uint64_t revision;
+		std::vector<int16_t> x, y, width, height;
+		std::vector<uint64_t> valid;
+	};
+
+	//grows the track's range to include frame, leaving as much headroom again in the direction it grew
+	void cover_(Track & track, size_t frame);
+
+	std::vector<Track> tracks_;
+	size_t count_;
+	uint64_t revision_;
+};
+
+template <typename Fn>
+void TrackStore::for_each(size_t track, Fn fn) const {
+	const Track & t = tracks_[track];
+	for (size_t word = 0; word < t.valid.size(); word++) {
+		uint64_t bits = t.valid[word];
+		while (bits != 0) {
+			size_t i = 64 * word + std::countr_zero(bits);
+			bits &= bits - 1;
+			fn(t.first + i, cv::Rect(t.x[i], t.y[i], t.width[i], t.height[i]));
+		}
+	}
+}